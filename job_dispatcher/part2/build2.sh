@@ -12,10 +12,10 @@ if [ $? -eq 0 ]; then
     if [ "$1" != "" ]; then
         # Run the program with 4 processes (1 main server + 3 workers)
         echo "Starting dispatcher with 4 processes..."
-        mpirun -np 4 ./dispatcher "$1"
+        mpirun -np 4 ./dispatcher "$1" $2 $3
         rm -f dispatcher
     else
-        echo "Usage: ./build.sh <command_file>"
+        echo "Usage: ./build2.sh <command_file> [commands in flight per worker] [result cache file]"
         echo "Please provide a command file as argument"
     fi
 else
@@ -5,18 +5,26 @@
 #include <time.h>
 #include <unistd.h>
 #include <math.h>
+#include <errno.h>
+#include <ctype.h>
+#include <limits.h>
 #include <sys/stat.h>
 
 #define MAX_CMD_LEN 256
 #define MAX_RESULT_LEN 4096
 #define TAG_WORK 1
 #define TAG_RESULT 2
+#define TAG_RESULT_CHUNK 3    // rest of a result longer than MAX_RESULT_LEN
+#define RESULT_CHUNK_LEN (64 * 1024)
+#define DEFAULT_PREFETCH 2 // commands in flight per worker, the optional second argument changes it
+#define MAX_PREFETCH 16
 
 // Command types
 #define CMD_PRIMES 1
 #define CMD_PRIMEDIVISORS 2
 #define CMD_ANAGRAMS 3
 #define CMD_WAIT 4
+#define CMD_FACTOR_RACE 7 // one attempt of a raced PRIMEDIVISORS, only sent by the master
 
 typedef struct {
     int type;
@@ -25,78 +33,445 @@ typedef struct {
 } Command;
 
 // Worker functions
-int is_prime(int n) {
+int is_prime(long long n) {
     if (n <= 1) return 0;
     if (n <= 3) return 1;
     if (n % 2 == 0 || n % 3 == 0) return 0;
     
-    for (int i = 5; i * i <= n; i += 6) {
+    for (long long i = 5; i * i <= n; i += 6) {
         if (n % i == 0 || n % (i + 2) == 0) return 0;
     }
     return 1;
 }
 
-void count_primes(int n, char *result) {
-    int count = 0;
-    for (int i = 2; i <= n; i++) {
-        if (is_prime(i)) count++;
+#define SIEVE_SEGMENT (32 * 1024)   // odd numbers per sieve segment, one byte each so it stays in L1
+#define PRIMES_MAX 1000000000000LL  // largest PRIMES n, Lucy keeps 2*sqrt(n) counters
+#define PRIMES_VERIFY_LIMIT 3000    // with -DVERIFY_PRIMES the fast counts are checked against trial division up to here
+#define LUCY_COST 12                // a Lucy counter update costs about as much as sieving 12 numbers
+
+long long isqrt_ll(long long n) {
+    long long r = (long long)sqrt((double)n);
+    while (r * r > n) r--;
+    while ((r + 1) * (r + 1) <= n) r++;
+    return r;
+}
+
+/*
+    Segmented sieve of Eratosthenes over the odd numbers: the primes up to sqrt(n) are sieved
+    first, then every segment of SIEVE_SEGMENT odd numbers is crossed off by them while it is
+    in cache. next[] remembers where each prime continues in the following segment
+*/
+long long count_primes_sieve(long long n) {
+    if (n < 2) return 0;
+    long long root = isqrt_ll(n);
+
+    char *small = calloc(root + 1, 1);
+    long long *primes = malloc((root / 2 + 1) * sizeof(long long));
+    long long *next = malloc((root / 2 + 1) * sizeof(long long));
+    int prime_count = 0;
+    for (long long i = 3; i <= root; i += 2) {
+        if (!small[i]) {
+            primes[prime_count] = i;
+            next[prime_count++] = i * i;
+            for (long long j = i * i; j <= root; j += 2 * i) small[j] = 1;
+        }
+    }
+
+    char segment[SIEVE_SEGMENT];
+    long long count = 1; // 2
+    for (long long low = 3; low <= n; low += 2 * SIEVE_SEGMENT) {
+        // segment[k] is the odd number low + 2k
+        long long high = low + 2 * (SIEVE_SEGMENT - 1);
+        if (high > n) high = n;
+        int length = (int)((high - low) / 2 + 1);
+        memset(segment, 0, length);
+        for (int i = 0; i < prime_count; i++) {
+            long long j = next[i];
+            for (; j <= high; j += 2 * primes[i]) segment[(j - low) / 2] = 1;
+            next[i] = j;
+        }
+        for (int k = 0; k < length; k++) {
+            count += !segment[k];
+        }
     }
-    sprintf(result, "Number of primes up to %d: %d", n, count);
+    free(small);
+    free(primes);
+    free(next);
+    return count;
 }
 
-void count_prime_divisors(int n, char *result) {
-    int original = n;
-    int count = 0;
-    int divisors[100] = {0};
-    int div_count = 0;
-    
-    for (int i = 2; i <= sqrt(n); i++) {
-        if (n % i == 0 && is_prime(i)) {
-            divisors[div_count++] = i;
-            while (n % i == 0) {
-                n /= i;
+/*
+    Lucy_Hedgehog's prime counting, O(n^(3/4)) time and O(sqrt(n)) memory. S(v) starts as the
+    count of 2..v and sieving by each prime p <= sqrt(n) removes the numbers whose smallest
+    prime factor is p: S(v) -= S(v/p) - S(p-1). Only the values n/i are needed, small[v] holds
+    S(v) for v <= sqrt(n) and large[i] holds S(n/i)
+*/
+long long count_primes_lucy(long long n) {
+    if (n < 2) return 0;
+    long long root = isqrt_ll(n);
+    long long *small = malloc((root + 1) * sizeof(long long));
+    long long *large = malloc((root + 1) * sizeof(long long));
+    for (long long v = 1; v <= root; v++) {
+        small[v] = v - 1;
+        large[v] = n / v - 1;
+    }
+
+    for (long long p = 2; p <= root; p++) {
+        if (small[p] == small[p - 1]) continue; // not a prime
+        long long below = small[p - 1];
+        long long square = p * p;
+        long long limit = n / square < root ? n / square : root;
+        for (long long i = 1; i <= limit; i++) {
+            long long d = i * p;
+            large[i] -= (d <= root ? large[d] : small[n / d]) - below;
+        }
+        for (long long v = root; v >= square; v--) {
+            small[v] -= small[v / p] - below;
+        }
+    }
+
+    long long count = large[1];
+    free(small);
+    free(large);
+    return count;
+}
+
+/*
+    The sieve costs about n, Lucy about n^(3/4)/log(n^(1/4)) counter updates. The cheaper one is
+    used: the sieve for n up to a few thousand, Lucy above (1e9 takes 1 s sieved, 12 ms with Lucy)
+*/
+long long count_primes_fast(long long n) {
+    if (n < 2) return 0;
+    double quarter = sqrt(sqrt((double)n));
+    double sieve_cost = (double)n;
+    double lucy_cost = LUCY_COST * quarter * quarter * quarter / (quarter > 2 ? log(quarter) : 1);
+    return sieve_cost <= lucy_cost ? count_primes_sieve(n) : count_primes_lucy(n);
+}
+
+#ifdef VERIFY_PRIMES
+/*
+    Checks the sieve and Lucy against trial division for every n up to limit, returns the
+    first n where they differ or -1. Only built with -DVERIFY_PRIMES, the check runs at startup
+*/
+long long verify_prime_counting(long long limit) {
+    long long count = 0;
+    for (long long n = 0; n <= limit; n++) {
+        if (n >= 2 && is_prime(n)) count++;
+        if (count_primes_sieve(n) != count || count_primes_lucy(n) != count) {
+            return n;
+        }
+    }
+    return -1;
+}
+#endif
+
+void count_primes(long long n, char *result) {
+    if (n > PRIMES_MAX) {
+        sprintf(result, "PRIMES supports n up to %lld", PRIMES_MAX);
+        return;
+    }
+    sprintf(result, "Number of primes up to %lld: %lld", n, count_primes_fast(n));
+}
+
+/*
+    Factorization for PRIMEDIVISORS. Numbers below SPF_LIMIT are answered from a smallest prime
+    factor table in O(log n) steps. Larger ones are trial divided by the primes below
+    FACTOR_WHEEL_LIMIT, the cofactor is checked with Miller-Rabin and split with Pollard-Brent
+    rho until every part is prime, about n^(1/4) steps for the hardest 64 bit numbers. Rho tries
+    the constants c = first_c, first_c + c_step, ... so raced attempts walk different sequences
+*/
+#define SPF_LIMIT (1 << 20)
+#define FACTOR_WHEEL_LIMIT 1024
+#define MAX_PRIME_FACTORS 64   // distinct primes of a 64 bit number are at most 15
+
+typedef struct {
+    unsigned long long primes[MAX_PRIME_FACTORS];
+    int count;
+} PrimeFactors;
+
+// Smallest prime factor of every n below SPF_LIMIT, built on first use and kept by the worker
+static unsigned int *spf_table = NULL;
+
+const unsigned int *smallest_prime_factors(void) {
+    if (spf_table) return spf_table;
+    spf_table = calloc(SPF_LIMIT, sizeof(unsigned int));
+    for (unsigned int i = 2; i < SPF_LIMIT; i++) {
+        if (spf_table[i]) continue;
+        for (unsigned int j = i; j < SPF_LIMIT; j += i) {
+            if (!spf_table[j]) spf_table[j] = i;
+        }
+    }
+    return spf_table;
+}
+
+void add_prime_factor(PrimeFactors *factors, unsigned long long p) {
+    for (int i = 0; i < factors->count; i++) {
+        if (factors->primes[i] == p) return;
+    }
+    if (factors->count < MAX_PRIME_FACTORS) {
+        factors->primes[factors->count++] = p;
+    }
+}
+
+unsigned long long mul_mod(unsigned long long a, unsigned long long b, unsigned long long m) {
+    return (unsigned long long)((unsigned __int128)a * b % m);
+}
+
+unsigned long long pow_mod(unsigned long long base, unsigned long long exp, unsigned long long m) {
+    unsigned long long result = 1;
+    base %= m;
+    while (exp) {
+        if (exp & 1) result = mul_mod(result, base, m);
+        base = mul_mod(base, base, m);
+        exp >>= 1;
+    }
+    return result;
+}
+
+// Miller-Rabin with the first twelve primes as bases, exact for every 64 bit n
+int is_prime_mr(unsigned long long n) {
+    static const unsigned long long bases[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37};
+    if (n < 2) return 0;
+    for (int i = 0; i < 12; i++) {
+        if (n % bases[i] == 0) return n == bases[i];
+    }
+    unsigned long long d = n - 1;
+    int r = 0;
+    while ((d & 1) == 0) {
+        d >>= 1;
+        r++;
+    }
+    for (int i = 0; i < 12; i++) {
+        unsigned long long x = pow_mod(bases[i], d, n);
+        if (x == 1 || x == n - 1) continue;
+        int composite = 1;
+        for (int j = 1; j < r && composite; j++) {
+            x = mul_mod(x, x, n);
+            composite = x != n - 1;
+        }
+        if (composite) return 0;
+    }
+    return 1;
+}
+
+unsigned long long gcd_ull(unsigned long long a, unsigned long long b) {
+    while (b) {
+        unsigned long long t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/*
+    Pollard rho with Brent's cycle detection on x^2 + c, the differences are multiplied together
+    so a gcd is taken only every 128 steps. Returns a divisor of the odd composite n, which is n
+    itself when this c failed
+*/
+unsigned long long pollard_brent(unsigned long long n, unsigned long long c) {
+    unsigned long long y = 2, x = 2, ys = 2, q = 1, g = 1;
+    unsigned long long r = 1, m = 128;
+    while (g == 1) {
+        x = y;
+        for (unsigned long long i = 0; i < r; i++) {
+            y = (mul_mod(y, y, n) + c) % n;
+        }
+        for (unsigned long long k = 0; k < r && g == 1; k += m) {
+            ys = y;
+            for (unsigned long long i = 0; i < m && i < r - k; i++) {
+                y = (mul_mod(y, y, n) + c) % n;
+                q = mul_mod(q, x > y ? x - y : y - x, n);
             }
+            g = gcd_ull(q, n);
         }
+        r *= 2;
     }
-    
-    if (n > 1 && is_prime(n)) {
-        divisors[div_count++] = n;
+    if (g == n) {
+        // The batch overshot, step through it one by one
+        do {
+            ys = (mul_mod(ys, ys, n) + c) % n;
+            g = gcd_ull(x > ys ? x - ys : ys - x, n);
+        } while (g == 1);
     }
-    
-    sprintf(result, "Number %d has %d prime divisors: ", original, div_count);
-    for (int i = 0; i < div_count; i++) {
+    return g;
+}
+
+void factor_large(unsigned long long n, PrimeFactors *factors, unsigned long long first_c, unsigned long long c_step) {
+    if (n == 1) return;
+    if (n < SPF_LIMIT) {
+        const unsigned int *spf = smallest_prime_factors();
+        while (n > 1) {
+            unsigned int p = spf[n];
+            add_prime_factor(factors, p);
+            while (n % p == 0) n /= p;
+        }
+        return;
+    }
+    if (is_prime_mr(n)) {
+        add_prime_factor(factors, n);
+        return;
+    }
+    unsigned long long d = n;
+    for (unsigned long long c = first_c; d == n; c += c_step) {
+        d = pollard_brent(n, c);
+    }
+    factor_large(d, factors, first_c, c_step);
+    factor_large(n / d, factors, first_c, c_step);
+}
+
+int compare_factors(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+    return (x > y) - (x < y);
+}
+
+void factorize(unsigned long long n, PrimeFactors *factors, unsigned long long first_c, unsigned long long c_step) {
+    factors->count = 0;
+    if (n >= SPF_LIMIT) {
+        // Small primes first, the wheel is the primes of the table below FACTOR_WHEEL_LIMIT
+        const unsigned int *spf = smallest_prime_factors();
+        for (unsigned int p = 2; p < FACTOR_WHEEL_LIMIT && (unsigned long long)p * p <= n; p++) {
+            if (spf[p] == p && n % p == 0) {
+                add_prime_factor(factors, p);
+                while (n % p == 0) n /= p;
+            }
+        }
+    }
+    factor_large(n, factors, first_c, c_step);
+    qsort(factors->primes, factors->count, sizeof(unsigned long long), compare_factors);
+}
+
+/*
+    Reads the number of a PRIMEDIVISORS. Every unsigned 64 bit value is accepted, anything else
+    (a sign, other characters, a value that does not fit) is rejected instead of being clamped
+*/
+int parse_factor_number(const char *text, unsigned long long *n) {
+    while (isspace((unsigned char)*text)) text++;
+    if (!isdigit((unsigned char)*text)) return 0;
+    char *end;
+    errno = 0;
+    *n = strtoull(text, &end, 10);
+    if (errno == ERANGE) return 0;
+    while (isspace((unsigned char)*end)) end++;
+    return *end == '\0';
+}
+
+void count_prime_divisors(unsigned long long n, unsigned long long first_c, unsigned long long c_step, char *result) {
+    PrimeFactors factors = {0};
+    if (n > 1) {
+        factorize(n, &factors, first_c, c_step);
+    }
+
+    sprintf(result, "Number %llu has %d prime divisors: ", n, factors.count);
+    for (int i = 0; i < factors.count; i++) {
         char temp[32];
-        sprintf(temp, "%d ", divisors[i]);
+        sprintf(temp, "%llu ", factors.primes[i]);
         strcat(result, temp);
     }
 }
 
-void generate_anagrams(char *str, int start, int end, char *result, int *count) {
-    if (*count >= 100) return; // Limit number of anagrams to prevent buffer overflow
-    
-    if (start == end) {
-        if (strlen(result) + strlen(str) + 2 < MAX_RESULT_LEN) {
-            strcat(result, str);
-            strcat(result, " ");
-            (*count)++;
-        }
-    } else {
-        for (int i = start; i <= end && *count < 100; i++) {
-            // Swap
-            char temp = str[start];
-            str[start] = str[i];
-            str[i] = temp;
-            
-            generate_anagrams(str, start + 1, end, result, count);
-            
-            // Restore
-            temp = str[start];
-            str[start] = str[i];
-            str[i] = temp;
+// Growable text of a result, appends are amortized O(1) so results of any length fit
+typedef struct {
+    char *data;
+    size_t length;   // without the terminating '\0'
+    size_t capacity;
+} ResultBuffer;
+
+void result_append(ResultBuffer *buffer, const char *text, size_t length) {
+    if (buffer->length + length + 1 > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 256;
+        while (capacity < buffer->length + length + 1) {
+            capacity *= 2;
         }
+        buffer->data = realloc(buffer->data, capacity);
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, text, length);
+    buffer->length += length;
+    buffer->data[buffer->length] = '\0';
+}
+
+void result_clear(ResultBuffer *buffer) {
+    buffer->length = 0;
+    if (buffer->data) {
+        buffer->data[0] = '\0';
+    }
+}
+
+/*
+    A result on its way to the master. Parts are sent as soon as they are complete, so a long
+    result never has to be held by the worker: the first MAX_RESULT_LEN bytes on TAG_RESULT
+    (no '\0' at the end, so the master knows more follows), then RESULT_CHUNK_LEN pieces on
+    TAG_RESULT_CHUNK. The last part carries the '\0', a short result is a single message
+*/
+typedef struct {
+    ResultBuffer text;   // not sent yet
+    int parts;           // parts sent so far
+} ResultStream;
+
+void stream_begin(ResultStream *stream, const char *client) {
+    result_clear(&stream->text);
+    stream->parts = 0;
+    result_append(&stream->text, "CLIENT:", 7);
+    result_append(&stream->text, client, strlen(client));
+    result_append(&stream->text, " RESULT:", 8);
+}
+
+void stream_append(ResultStream *stream, const char *text, size_t length) {
+    result_append(&stream->text, text, length);
+    size_t part;
+    while (stream->text.length >= (part = stream->parts == 0 ? MAX_RESULT_LEN : RESULT_CHUNK_LEN)) {
+        MPI_Send(stream->text.data, (int)part, MPI_CHAR, 0,
+                 stream->parts == 0 ? TAG_RESULT : TAG_RESULT_CHUNK, MPI_COMM_WORLD);
+        stream->parts++;
+        stream->text.length -= part;
+        memmove(stream->text.data, stream->text.data + part, stream->text.length + 1);
     }
 }
 
+void stream_finish(ResultStream *stream) {
+    MPI_Send(stream->text.data, (int)stream->text.length + 1, MPI_CHAR, 0,
+             stream->parts == 0 ? TAG_RESULT : TAG_RESULT_CHUNK, MPI_COMM_WORLD);
+    result_clear(&stream->text);
+    stream->parts = 0;
+}
+
+int compare_chars(const void *a, const void *b) {
+    return *(const unsigned char *)a - *(const unsigned char *)b;
+}
+
+// Rearranges the letters into the next greater permutation, 0 when they are the greatest one
+int next_permutation(char *letters, size_t n) {
+    if (n < 2) return 0;
+    size_t i = n - 1;
+    while (i > 0 && letters[i - 1] >= letters[i]) i--;
+    if (i == 0) return 0;
+    size_t j = n - 1;
+    while (letters[j] <= letters[i - 1]) j--;
+    char temp = letters[i - 1];
+    letters[i - 1] = letters[j];
+    letters[j] = temp;
+    for (size_t k = n - 1; i < k; i++, k--) {
+        temp = letters[i];
+        letters[i] = letters[k];
+        letters[k] = temp;
+    }
+    return 1;
+}
+
+/*
+    Every distinct anagram once, in lexicographic order: the letters are sorted and stepped
+    through their permutations, a repeated letter never produces the same word twice
+*/
+void generate_anagrams(char *word, ResultStream *out) {
+    size_t n = strlen(word);
+    if (n == 0) return;
+    qsort(word, n, 1, compare_chars);
+    do {
+        stream_append(out, word, n);
+        stream_append(out, " ", 1);
+    } while (next_permutation(word, n));
+}
+
 // Server functions
 void write_to_log(FILE *log_file, const char *client, const char *action, const char *details) {
     time_t now;
@@ -119,6 +494,183 @@ void write_result_to_file(const char *client, const char *result) {
 
 
 
+/*
+    Results of earlier commands, keyed by command type and parameters. The master answers a
+    repeated PRIMES, PRIMEDIVISORS or ANAGRAMS from here without dispatching it. Bounded by
+    CACHE_ENTRIES and CACHE_BYTES, the least recently used results are dropped first. With a
+    cache file the results survive the run: it is loaded at startup and written at shutdown
+*/
+#define CACHE_ENTRIES 1024
+#define CACHE_BYTES (16 * 1024 * 1024)
+#define CACHE_BUCKETS 2048
+#define CACHE_KEY_LEN 208   // the type and the params of a command
+
+typedef struct CacheEntry {
+    char key[CACHE_KEY_LEN];            // "<type> <params>"
+    char *result;
+    size_t length;
+    struct CacheEntry *newer, *older;   // recency list
+    struct CacheEntry *chain;           // same hash bucket
+} CacheEntry;
+
+typedef struct {
+    CacheEntry *buckets[CACHE_BUCKETS];
+    CacheEntry *newest, *oldest;
+    int entries;
+    size_t bytes;
+    long lookups;
+    long hits;
+    const char *path;                   // cache file, NULL keeps the results in memory only
+} ResultCache;
+
+int is_cacheable(const Command *cmd) {
+    return cmd->type == CMD_PRIMES || cmd->type == CMD_PRIMEDIVISORS || cmd->type == CMD_ANAGRAMS;
+}
+
+void cache_key(const Command *cmd, char *key, size_t size) {
+    snprintf(key, size, "%d %s", cmd->type, cmd->params);
+}
+
+CacheEntry **cache_bucket(ResultCache *cache, const char *key) {
+    unsigned long hash = 5381;
+    for (const char *c = key; *c; c++) {
+        hash = hash * 33 + (unsigned char)*c;
+    }
+    return &cache->buckets[hash % CACHE_BUCKETS];
+}
+
+void cache_unlink(ResultCache *cache, CacheEntry *entry) {
+    if (entry->newer) entry->newer->older = entry->older; else cache->newest = entry->older;
+    if (entry->older) entry->older->newer = entry->newer; else cache->oldest = entry->newer;
+}
+
+void cache_push_newest(ResultCache *cache, CacheEntry *entry) {
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    if (cache->newest) cache->newest->newer = entry; else cache->oldest = entry;
+    cache->newest = entry;
+}
+
+CacheEntry *cache_find(ResultCache *cache, const char *key) {
+    for (CacheEntry *entry = *cache_bucket(cache, key); entry; entry = entry->chain) {
+        if (strcmp(entry->key, key) == 0) return entry;
+    }
+    return NULL;
+}
+
+void cache_evict_oldest(ResultCache *cache) {
+    CacheEntry *entry = cache->oldest;
+    cache_unlink(cache, entry);
+    CacheEntry **link = cache_bucket(cache, entry->key);
+    while (*link != entry) link = &(*link)->chain;
+    *link = entry->chain;
+    cache->entries--;
+    cache->bytes -= entry->length;
+    free(entry->result);
+    free(entry);
+}
+
+void cache_init(ResultCache *cache, const char *path) {
+    memset(cache, 0, sizeof(*cache));
+    cache->path = path;
+}
+
+void cache_insert(ResultCache *cache, const char *key, const char *result) {
+    size_t length = strlen(result);
+    if (length > CACHE_BYTES / 4) {
+        return; // one result must not push out most of the others
+    }
+    CacheEntry *entry = cache_find(cache, key);
+    if (entry) {
+        cache_unlink(cache, entry);
+        cache->bytes -= entry->length;
+        free(entry->result);
+    } else {
+        entry = malloc(sizeof(CacheEntry));
+        snprintf(entry->key, sizeof(entry->key), "%s", key);
+        CacheEntry **bucket = cache_bucket(cache, key);
+        entry->chain = *bucket;
+        *bucket = entry;
+        cache->entries++;
+    }
+    entry->result = strdup(result);
+    entry->length = length;
+    cache->bytes += length;
+    cache_push_newest(cache, entry);
+
+    while (cache->entries > CACHE_ENTRIES || cache->bytes > CACHE_BYTES) {
+        cache_evict_oldest(cache);
+    }
+}
+
+// The cached result of the command, NULL on a miss. A hit becomes the most recently used
+const char *cache_lookup(ResultCache *cache, const Command *cmd) {
+    if (!is_cacheable(cmd)) return NULL;
+    char key[CACHE_KEY_LEN];
+    cache_key(cmd, key, sizeof(key));
+    cache->lookups++;
+    CacheEntry *entry = cache_find(cache, key);
+    if (!entry) return NULL;
+    cache->hits++;
+    cache_unlink(cache, entry);
+    cache_push_newest(cache, entry);
+    return entry->result;
+}
+
+void cache_store(ResultCache *cache, const Command *cmd, const char *result) {
+    if (!is_cacheable(cmd)) return;
+    char key[CACHE_KEY_LEN];
+    cache_key(cmd, key, sizeof(key));
+    cache_insert(cache, key, result);
+}
+
+/*
+    The cache file has one "<key>\t<result>" line per entry, oldest first, so loading it in order
+    restores the recency too. A missing file is an empty cache
+*/
+void cache_load(ResultCache *cache) {
+    if (!cache->path) return;
+    FILE *file = fopen(cache->path, "r");
+    if (!file) return;
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &capacity, file)) > 0) {
+        if (line[length - 1] == '\n') line[--length] = '\0';
+        char *tab = strchr(line, '\t');
+        if (tab) {
+            *tab = '\0';
+            cache_insert(cache, line, tab + 1);
+        }
+    }
+    free(line);
+    fclose(file);
+}
+
+// Written next to the cache file and renamed over it, a crash never leaves half a cache
+void cache_save(ResultCache *cache) {
+    if (!cache->path) return;
+    char tmp_path[1024];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache->path);
+    FILE *file = fopen(tmp_path, "w");
+    if (!file) {
+        printf("Error opening cache file: %s\n", tmp_path);
+        return;
+    }
+    for (CacheEntry *entry = cache->oldest; entry; entry = entry->newer) {
+        fprintf(file, "%s\t%s\n", entry->key, entry->result);
+    }
+    if (fclose(file) != 0 || rename(tmp_path, cache->path) != 0) {
+        perror("cache file error");
+    }
+}
+
+void cache_free(ResultCache *cache) {
+    while (cache->oldest) {
+        cache_evict_oldest(cache);
+    }
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////
 
 // For matrix operations
@@ -133,8 +685,8 @@ typedef struct {
     int end_row;     // Ending row for this chunk
     int num_workers; // Total number of workers
     int worker_rank; // This worker's rank
-    double *matrix1; // Full first matrix for multiplication
-    double *matrix2; // Full second matrix
+    double *matrix1; // First matrix, or a worker's block of its rows
+    double *matrix2; // Second matrix (a block of rows for an addition)
     double *result;  // Partial result matrix
 } ParallelMatrixTask;
 
@@ -201,30 +753,129 @@ void parallel_matrix_add(ParallelMatrixTask *task) {
     }
 }
 
-void check_completed_work(int *worker_status, int size, FILE *log_file) {
-    MPI_Status status;
-    char result[MAX_RESULT_LEN];
-    int flag;
-
+/*
+    Elements of each rank's block of rows and where it starts, for Scatterv and Gatherv. The
+    master (rank 0) gets none, the first size % workers workers get one row more than the rest
+*/
+void matrix_row_counts(int matrix_size, int size, int* counts, int* displs) {
+    int workers = size - 1;
+    int row = 0;
+    counts[0] = 0;
+    displs[0] = 0;
     for (int i = 1; i < size; i++) {
-        if (worker_status[i] == 1) {
-            MPI_Iprobe(i, TAG_RESULT, MPI_COMM_WORLD, &flag, &status);
-            if (flag) {
-                MPI_Recv(result, MAX_RESULT_LEN, MPI_CHAR, i, TAG_RESULT, 
-                        MPI_COMM_WORLD, &status);
-                worker_status[i] = 0;
-                
-                if (strlen(result) > 0) {
-                    char client_id[64];
-                    char *result_start = strstr(result, "RESULT:");
-                    if (result_start) {
-                        int client_len = result_start - result - 7; // subtract "CLIENT:" length
-                        strncpy(client_id, result + 7, client_len);
-                        client_id[client_len] = '\0';
-                        char *actual_result = result_start + 7;
-                        
-                        write_to_log(log_file, client_id, "COMPLETED", actual_result);
-                        write_result_to_file(client_id, actual_result);
+        int rows = matrix_size / workers + (i - 1 < matrix_size % workers ? 1 : 0);
+        counts[i] = rows * matrix_size;
+        displs[i] = row * matrix_size;
+        row += rows;
+    }
+}
+
+/*
+    SUMMA for large products: the workers form a grid_rows x grid_cols grid and each one keeps
+    one block of A, B and C. The k dimension is walked in panels: the worker column owning a
+    panel of A broadcasts it along each grid row, the worker row owning the panel of B
+    broadcasts it down each grid column, and everyone adds their product to its C block. The
+    broadcast of the next panel is in flight while the current one is multiplied.
+    Compared with row blocks no worker ever needs all of B
+*/
+#define SUMMA_PANEL 64         // columns of A (rows of B) per broadcast
+#define GEMM_BLOCK 64          // cache block of the local multiplication
+#define MESSAGE_COST_BYTES 8192.0 // latency of one message, in bytes it could have moved instead
+
+#define MATRIX_ROWS 0          // algorithms of a parallel matrix operation
+#define MATRIX_SUMMA 1
+
+typedef struct {
+    int rows, cols;            // the grid, workers beyond rows * cols sit SUMMA out
+    MPI_Comm row_comm;         // workers of my grid row, ranked by grid column
+    MPI_Comm col_comm;         // workers of my grid column, ranked by grid row
+} MatrixGrid;
+
+static MPI_Comm worker_comm = MPI_COMM_NULL; // every rank but the master
+static MatrixGrid grid = {0, 0, MPI_COMM_NULL, MPI_COMM_NULL};
+
+// As square a grid as the workers allow, rows <= cols
+void matrix_grid(int workers, int* grid_rows, int* grid_cols) {
+    int rows = (int)sqrt((double)workers);
+    while (rows > 1 && workers / rows < rows) rows--;
+    *grid_rows = rows > 0 ? rows : 1;
+    *grid_cols = workers / *grid_rows;
+}
+
+// Splits the workers into the rows and columns of the SUMMA grid, once at startup
+void init_matrix_grid(int rank) {
+    int workers;
+    MPI_Comm_size(worker_comm, &workers);
+    matrix_grid(workers, &grid.rows, &grid.cols);
+    int g = rank - 1;
+    int in_grid = g < grid.rows * grid.cols;
+    MPI_Comm_split(worker_comm, in_grid ? g / grid.cols : MPI_UNDEFINED, g % grid.cols, &grid.row_comm);
+    MPI_Comm_split(worker_comm, in_grid ? g % grid.cols : MPI_UNDEFINED, g / grid.cols, &grid.col_comm);
+}
+
+void free_matrix_grid(void) {
+    if (grid.row_comm != MPI_COMM_NULL) MPI_Comm_free(&grid.row_comm);
+    if (grid.col_comm != MPI_COMM_NULL) MPI_Comm_free(&grid.col_comm);
+    MPI_Comm_free(&worker_comm);
+}
+
+// n split into parts blocks, the first n % parts one longer
+void block_range(int n, int parts, int index, int* start, int* length) {
+    int base = n / parts, extra = n % parts;
+    *start = index * base + (index < extra ? index : extra);
+    *length = base + (index < extra ? 1 : 0);
+}
+
+int block_owner(int n, int parts, int k) {
+    int base = n / parts, extra = n % parts;
+    if (k < (base + 1) * extra) return k / (base + 1);
+    return extra + (k - (base + 1) * extra) / base;
+}
+
+// End of the panel starting at k: it never crosses a block of A's columns or of B's rows
+int summa_panel_end(int n, int grid_rows, int grid_cols, int k) {
+    int end = k + SUMMA_PANEL < n ? k + SUMMA_PANEL : n;
+    int start, length;
+    block_range(n, grid_cols, block_owner(n, grid_cols, k), &start, &length);
+    if (start + length < end) end = start + length;
+    block_range(n, grid_rows, block_owner(n, grid_rows, k), &start, &length);
+    if (start + length < end) end = start + length;
+    return end;
+}
+
+/*
+    Bytes a worker receives or sends for an n x n product, plus MESSAGE_COST_BYTES per message.
+    Row blocks: its rows of A, all of B, its rows of C. SUMMA: its blocks of A and B, the
+    panels of the other grid columns and rows, its block of C
+*/
+int choose_matrix_algorithm(int n, int workers) {
+    int grid_rows, grid_cols;
+    matrix_grid(workers, &grid_rows, &grid_cols);
+    if (grid_rows < 2) {
+        return MATRIX_ROWS;
+    }
+    double words = (double)n * n * sizeof(double);
+    double rows_cost = words * (1.0 + 2.0 / workers) + 3 * MESSAGE_COST_BYTES;
+    int panels = 0;
+    for (int k = 0; k < n; k = summa_panel_end(n, grid_rows, grid_cols, k)) panels++;
+    double summa_cost = words * (1.0 / grid_rows + 1.0 / grid_cols + 1.0 / (grid_rows * grid_cols))
+                      + (3 + 2 * panels) * MESSAGE_COST_BYTES;
+    return summa_cost < rows_cost ? MATRIX_SUMMA : MATRIX_ROWS;
+}
+
+// c (m x n) += a (m x k) * b (k x n), blocked so the rows of b in use stay in cache
+void gemm_block(int m, int n, int k, const double* a, int lda, const double* b, int ldb, double* c, int ldc) {
+    for (int kk = 0; kk < k; kk += GEMM_BLOCK) {
+        int k_end = kk + GEMM_BLOCK < k ? kk + GEMM_BLOCK : k;
+        for (int jj = 0; jj < n; jj += GEMM_BLOCK) {
+            int j_end = jj + GEMM_BLOCK < n ? jj + GEMM_BLOCK : n;
+            for (int i = 0; i < m; i++) {
+                double* c_row = &c[i * ldc];
+                for (int p = kk; p < k_end; p++) {
+                    double a_ip = a[i * lda + p];
+                    const double* b_row = &b[p * ldb];
+                    for (int j = jj; j < j_end; j++) {
+                        c_row[j] += a_ip * b_row[j];
                     }
                 }
             }
@@ -232,7 +883,476 @@ void check_completed_work(int *worker_status, int size, FILE *log_file) {
     }
 }
 
-void handle_matrix_operation(Command* cmd, int* worker_status, int size, FILE* log_file) {
+/*
+    The block of a matrix that grid position (r, c) holds, rows split over parts_r and columns
+    over parts_c, is packed or unpacked at buffer. Returns its number of elements
+*/
+int copy_block(double* matrix, int n, int parts_r, int parts_c, int r, int c, double* buffer, int pack) {
+    int row_start, rows, col_start, cols;
+    block_range(n, parts_r, r, &row_start, &rows);
+    block_range(n, parts_c, c, &col_start, &cols);
+    for (int i = 0; i < rows; i++) {
+        double* line = &matrix[(row_start + i) * n + col_start];
+        if (pack) {
+            memcpy(&buffer[i * cols], line, cols * sizeof(double));
+        } else {
+            memcpy(line, &buffer[i * cols], cols * sizeof(double));
+        }
+    }
+    return rows * cols;
+}
+
+// Packs the blocks of every grid position in rank order, counts and displs are per rank
+void pack_grid_blocks(double* matrix, int n, int grid_rows, int grid_cols, double* packed, int* counts, int* displs) {
+    int offset = 0;
+    for (int g = 0; g < grid_rows * grid_cols; g++) {
+        displs[g + 1] = offset;
+        counts[g + 1] = copy_block(matrix, n, grid_rows, grid_cols, g / grid_cols, g % grid_cols, packed + offset, 1);
+        offset += counts[g + 1];
+    }
+}
+
+/*
+    Master side of a SUMMA product: the blocks of A and B are packed in rank order and
+    scattered, the blocks of C are gathered and unpacked into result
+*/
+void summa_master(int n, int size, double* matrix1, double* matrix2, double* result) {
+    int grid_rows, grid_cols;
+    matrix_grid(size - 1, &grid_rows, &grid_cols);
+    int* counts = calloc(size, sizeof(int));
+    int* displs = calloc(size, sizeof(int));
+    double* packed = malloc((size_t)n * n * sizeof(double));
+    if (!counts || !displs || !packed) {
+        // The workers are already waiting in the scatter, there is no way back for them
+        printf("Error allocating the SUMMA buffers for n = %d\n", n);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+        return;
+    }
+
+    // A: rows over grid rows, k over grid columns
+    pack_grid_blocks(matrix1, n, grid_rows, grid_cols, packed, counts, displs);
+    MPI_Scatterv(packed, counts, displs, MPI_DOUBLE, NULL, 0, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+    // B: k over grid rows, columns over grid columns
+    pack_grid_blocks(matrix2, n, grid_rows, grid_cols, packed, counts, displs);
+    MPI_Scatterv(packed, counts, displs, MPI_DOUBLE, NULL, 0, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+    // C has the same layout as B
+    MPI_Gatherv(NULL, 0, MPI_DOUBLE, packed, counts, displs, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    for (int g = 0; g < grid_rows * grid_cols; g++) {
+        copy_block(result, n, grid_rows, grid_cols, g / grid_cols, g % grid_cols, packed + displs[g + 1], 0);
+    }
+
+    free(counts);
+    free(displs);
+    free(packed);
+}
+
+/*
+    Starts the broadcasts of the panel at k: the grid column owning those columns of A sends its
+    part of them along every grid row, the grid row owning those rows of B down every grid
+    column. Returns the end of the panel
+*/
+int summa_post_panel(int n, int k, int r, int c, int rows, int cols, const double* a, int ka, int ka_start,
+                     const double* b, int kb_start, double* a_panel, double* b_panel, MPI_Request* requests) {
+    int end = summa_panel_end(n, grid.rows, grid.cols, k);
+    int width = end - k;
+
+    int a_owner = block_owner(n, grid.cols, k);
+    if (c == a_owner) {
+        for (int i = 0; i < rows; i++) {
+            memcpy(&a_panel[i * width], &a[i * ka + (k - ka_start)], width * sizeof(double));
+        }
+    }
+    MPI_Ibcast(a_panel, rows * width, MPI_DOUBLE, a_owner, grid.row_comm, &requests[0]);
+
+    int b_owner = block_owner(n, grid.rows, k);
+    if (r == b_owner) {
+        memcpy(b_panel, &b[(k - kb_start) * cols], (size_t)width * cols * sizeof(double));
+    }
+    MPI_Ibcast(b_panel, width * cols, MPI_DOUBLE, b_owner, grid.col_comm, &requests[1]);
+    return end;
+}
+
+// Worker side of a SUMMA product, see summa_master
+void summa_worker(int n, int rank) {
+    int g = rank - 1;
+    int in_grid = g < grid.rows * grid.cols;
+    int r = in_grid ? g / grid.cols : 0, c = in_grid ? g % grid.cols : 0;
+    int row_start, rows, col_start, cols, ka_start, ka, kb_start, kb;
+    block_range(n, grid.rows, r, &row_start, &rows);    // my rows of A and C
+    block_range(n, grid.cols, c, &col_start, &cols);    // my columns of B and C
+    block_range(n, grid.cols, c, &ka_start, &ka);       // my columns of A
+    block_range(n, grid.rows, r, &kb_start, &kb);       // my rows of B
+    if (!in_grid) {
+        rows = cols = ka = kb = 0;
+    }
+
+    double* a = malloc((size_t)(rows * ka + 1) * sizeof(double));
+    double* b = malloc((size_t)(kb * cols + 1) * sizeof(double));
+    double* c_block = calloc((size_t)rows * cols + 1, sizeof(double));
+    if (!a || !b || !c_block) {
+        printf("Worker %d: error allocating the SUMMA blocks for n = %d\n", rank, n);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+        return;
+    }
+    MPI_Scatterv(NULL, NULL, NULL, MPI_DOUBLE, a, rows * ka, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    MPI_Scatterv(NULL, NULL, NULL, MPI_DOUBLE, b, kb * cols, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+    if (in_grid) {
+        // Two panels of each kind: one being multiplied, the next one arriving
+        double* a_panel[2];
+        double* b_panel[2];
+        for (int i = 0; i < 2; i++) {
+            a_panel[i] = malloc((size_t)(rows * SUMMA_PANEL + 1) * sizeof(double));
+            b_panel[i] = malloc((size_t)(SUMMA_PANEL * cols + 1) * sizeof(double));
+            if (!a_panel[i] || !b_panel[i]) {
+                printf("Worker %d: error allocating the SUMMA panels for n = %d\n", rank, n);
+                MPI_Abort(MPI_COMM_WORLD, 1);
+                return;
+            }
+        }
+        MPI_Request requests[2][2];
+
+        // The broadcasts of the next panel are posted before the current one is multiplied
+        int current = 0;
+        int start = 0;
+        int end = summa_post_panel(n, start, r, c, rows, cols, a, ka, ka_start, b, kb_start,
+                                   a_panel[0], b_panel[0], requests[0]);
+        while (start < n) {
+            int next_end = n;
+            if (end < n) {
+                next_end = summa_post_panel(n, end, r, c, rows, cols, a, ka, ka_start, b, kb_start,
+                                            a_panel[1 - current], b_panel[1 - current], requests[1 - current]);
+            }
+            MPI_Waitall(2, requests[current], MPI_STATUSES_IGNORE);
+            int width = end - start;
+            gemm_block(rows, cols, width, a_panel[current], width, b_panel[current], cols, c_block, cols);
+            start = end;
+            end = next_end;
+            current = 1 - current;
+        }
+        for (int i = 0; i < 2; i++) {
+            free(a_panel[i]);
+            free(b_panel[i]);
+        }
+    }
+
+    MPI_Gatherv(c_block, rows * cols, MPI_DOUBLE, NULL, NULL, NULL, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    free(a);
+    free(b);
+    free(c_block);
+}
+
+/*
+    How long Pollard-Brent takes on a hard PRIMEDIVISORS depends a lot on the constant c, the
+    same number can take 1 ms with one c and 4 ms with the next. Such a number is raced: every
+    idle worker factors it with its own sequence of c, the master takes the first result and
+    drops the others when they come in. Below RACE_MIN_STEPS one worker does it all
+*/
+#define RACE_MIN_STEPS 16384.0 // m^(1/4) for the composite part m left after the wheel, m above 2^56
+#define MAX_RACES 8
+
+typedef struct {
+    Command cmd;                        // as the client sent it, the result is cached under it
+    int attempts_left;                  // 0: the slot is free
+    int answered;
+} FactorRace;
+
+// Master side state: every worker has a result receive posted at all times
+typedef struct {
+    int size;                           // ranks, workers are 1..size-1
+    int *worker_status;                 // commands in flight per worker, queued or running
+    int prefetch;                       // at most this many in flight per worker
+    MPI_Request *requests;              // posted result receive per worker (index 0 unused)
+    char (*results)[MAX_RESULT_LEN];    // receive buffer per worker
+    int *completed;                     // MPI_Waitsome/Testsome output
+    MPI_Status *statuses;
+    char *pool;                         // reassembles results longer than MAX_RESULT_LEN, only grows
+    size_t pool_capacity;
+    Command (*inflight)[MAX_PREFETCH];  // per worker, the commands in flight in the order it runs them
+    int (*inflight_race)[MAX_PREFETCH]; // the FactorRace a command is an attempt of, -1 for none
+    int *inflight_head;
+    FactorRace races[MAX_RACES];
+    ResultCache cache;
+    FILE *log_file;
+    long jobs_dispatched;
+    long jobs_completed;
+    double first_dispatch;              // MPI_Wtime, for the jobs/s at shutdown
+    double last_completion;
+} Dispatcher;
+
+void post_result_recv(Dispatcher *d, int worker) {
+    MPI_Irecv(d->results[worker], MAX_RESULT_LEN, MPI_CHAR, worker, TAG_RESULT,
+              MPI_COMM_WORLD, &d->requests[worker]);
+}
+
+void init_dispatcher(Dispatcher *d, int size, int prefetch, FILE *log_file, const char *cache_path) {
+    d->size = size;
+    d->prefetch = prefetch;
+    d->worker_status = calloc(size, sizeof(int));
+    d->requests = malloc(size * sizeof(MPI_Request));
+    d->results = malloc(size * sizeof(*d->results));
+    d->completed = malloc(size * sizeof(int));
+    d->statuses = malloc(size * sizeof(MPI_Status));
+    d->pool = NULL;
+    d->pool_capacity = 0;
+    d->inflight = malloc(size * sizeof(*d->inflight));
+    d->inflight_race = malloc(size * sizeof(*d->inflight_race));
+    d->inflight_head = calloc(size, sizeof(int));
+    memset(d->races, 0, sizeof(d->races));
+    cache_init(&d->cache, cache_path);
+    cache_load(&d->cache);
+    d->log_file = log_file;
+    d->jobs_dispatched = 0;
+    d->jobs_completed = 0;
+    d->first_dispatch = 0;
+    d->last_completion = 0;
+
+    d->requests[0] = MPI_REQUEST_NULL;
+    for (int i = 1; i < size; i++) {
+        post_result_recv(d, i);
+    }
+}
+
+void free_dispatcher(Dispatcher *d) {
+    // Nothing is in flight any more, the posted receives are cancelled
+    for (int i = 1; i < d->size; i++) {
+        MPI_Cancel(&d->requests[i]);
+        MPI_Wait(&d->requests[i], MPI_STATUS_IGNORE);
+    }
+    free(d->worker_status);
+    free(d->requests);
+    free(d->results);
+    free(d->completed);
+    free(d->statuses);
+    free(d->pool);
+    free(d->inflight);
+    free(d->inflight_race);
+    free(d->inflight_head);
+    cache_save(&d->cache);
+    cache_free(&d->cache);
+}
+
+// Jobs in flight on all workers
+int busy_workers(Dispatcher *d) {
+    int busy = 0;
+    for (int i = 1; i < d->size; i++) {
+        busy += d->worker_status[i];
+    }
+    return busy;
+}
+
+void reserve_pool(Dispatcher *d, size_t capacity) {
+    if (capacity > d->pool_capacity) {
+        size_t grown = d->pool_capacity ? d->pool_capacity : MAX_RESULT_LEN;
+        while (grown < capacity) {
+            grown *= 2;
+        }
+        d->pool = realloc(d->pool, grown);
+        d->pool_capacity = grown;
+    }
+}
+
+/*
+    The first received bytes of a result without a '\0' at the end mean the worker is sending
+    the rest in chunks right behind them. Each chunk is sized with MPI_Probe and MPI_Get_count
+    and received into the pool after the bytes before it
+*/
+char *assemble_result(Dispatcher *d, int worker, int received) {
+    char *first = d->results[worker];
+    if (received > 0 && first[received - 1] == '\0') {
+        return first;
+    }
+
+    size_t length = received;
+    reserve_pool(d, length);
+    memcpy(d->pool, first, length);
+    while (length == 0 || d->pool[length - 1] != '\0') {
+        MPI_Status status;
+        int count;
+        MPI_Probe(worker, TAG_RESULT_CHUNK, MPI_COMM_WORLD, &status);
+        MPI_Get_count(&status, MPI_CHAR, &count);
+        reserve_pool(d, length + count);
+        MPI_Recv(d->pool + length, count, MPI_CHAR, worker, TAG_RESULT_CHUNK, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        length += count;
+    }
+    return d->pool;
+}
+
+void handle_result(Dispatcher *d, int worker, MPI_Status *status) {
+    int received;
+    MPI_Get_count(status, MPI_CHAR, &received);
+    char *result = assemble_result(d, worker, received);
+    Command *cmd = &d->inflight[worker][d->inflight_head[worker]];
+    int race = d->inflight_race[worker][d->inflight_head[worker]];
+    d->inflight_head[worker] = (d->inflight_head[worker] + 1) % MAX_PREFETCH;
+    d->worker_status[worker]--;
+
+    if (race >= 0) {
+        FactorRace *job = &d->races[race];
+        job->attempts_left--;
+        if (job->answered) {
+            // A faster attempt already answered the client
+            post_result_recv(d, worker);
+            return;
+        }
+        job->answered = 1;
+        cmd = &job->cmd;
+    }
+    d->jobs_completed++;
+    d->last_completion = MPI_Wtime();
+
+    if (strlen(result) > 0) {
+        char client_id[64];
+        char *result_start = strstr(result, "RESULT:");
+        if (result_start) {
+            int client_len = result_start - result - 8; // subtract "CLIENT:" and the space before "RESULT:"
+            strncpy(client_id, result + 7, client_len);
+            client_id[client_len] = '\0';
+            char *actual_result = result_start + 7;
+
+            write_to_log(d->log_file, client_id, "COMPLETED", actual_result);
+            write_result_to_file(client_id, actual_result);
+            cache_store(&d->cache, cmd, actual_result);
+        }
+    }
+
+    // Ready for the next result of this worker
+    post_result_recv(d, worker);
+}
+
+// Queues the command on the worker, its result comes back after the ones already in flight
+void send_command(Dispatcher *d, int worker, const Command *cmd, int race) {
+    int slot = (d->inflight_head[worker] + d->worker_status[worker]) % MAX_PREFETCH;
+    d->inflight[worker][slot] = *cmd;
+    d->inflight_race[worker][slot] = race;
+    d->worker_status[worker]++;
+    MPI_Send(cmd, sizeof(Command), MPI_CHAR, worker, TAG_WORK, MPI_COMM_WORLD);
+    if (d->jobs_dispatched++ == 0) {
+        d->first_dispatch = MPI_Wtime();
+    }
+}
+
+/*
+    The worker with the fewest commands in flight, -1 when every worker has prefetch of them.
+    Idle workers come first, a worker that still has room gets its next command queued locally,
+    so it starts on it right after sending a result instead of waiting for the master
+*/
+int pick_worker(Dispatcher *d) {
+    int best = -1;
+    for (int i = 1; i < d->size; i++) {
+        if (d->worker_status[i] < d->prefetch && (best == -1 || d->worker_status[i] < d->worker_status[best])) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+/*
+    Handles the results that arrive within timeout seconds and returns how many there were.
+    A negative timeout blocks in MPI_Waitsome until at least one worker is done, the master uses
+    no CPU while it waits. MPI has no timed wait, so a timeout (WAIT commands) polls
+    MPI_Testsome with a sleep that starts at 20 us and grows to 1 ms
+*/
+int wait_for_results(Dispatcher *d, double timeout) {
+    int outcount = 0;
+
+    if (busy_workers(d) == 0) {
+        // Nothing can arrive, a WAIT just sleeps
+        if (timeout > 0) {
+            usleep((useconds_t)(timeout * 1e6));
+        }
+        return 0;
+    }
+
+    if (timeout < 0) {
+        MPI_Waitsome(d->size - 1, d->requests + 1, &outcount, d->completed, d->statuses);
+    } else {
+        double deadline = MPI_Wtime() + timeout;
+        useconds_t pause = 20;
+        while (1) {
+            MPI_Testsome(d->size - 1, d->requests + 1, &outcount, d->completed, d->statuses);
+            if (outcount > 0 || MPI_Wtime() >= deadline) {
+                break;
+            }
+            usleep(pause);
+            if (pause < 1000) {
+                pause *= 2;
+            }
+        }
+    }
+
+    if (outcount == MPI_UNDEFINED) {
+        return 0;
+    }
+    for (int k = 0; k < outcount; k++) {
+        handle_result(d, d->completed[k] + 1, &d->statuses[k]);
+    }
+    return outcount;
+}
+
+/*
+    Pollard-Brent steps a PRIMEDIVISORS needs: about m^(1/4) for what is left after the wheel,
+    0 when that is 1 or a prime. Dividing by every p below the wheel limit leaves the same m as
+    dividing by the primes only, a composite p never divides what its prime factors left
+*/
+double race_steps(unsigned long long n) {
+    for (unsigned long long p = 2; p < FACTOR_WHEEL_LIMIT && p * p <= n; p++) {
+        while (n % p == 0) n /= p;
+    }
+    if (n < SPF_LIMIT || is_prime_mr(n)) {
+        return 0;
+    }
+    return sqrt(sqrt((double)n));
+}
+
+/*
+    Races a hard PRIMEDIVISORS on the idle workers, each attempt with its own constants of rho.
+    Returns 0 when the number is easy, fewer than two workers are idle or every race slot is
+    taken, the command then goes to one worker as usual
+*/
+int dispatch_race(Dispatcher *d, const Command *cmd) {
+    unsigned long long n;
+    if (!parse_factor_number(cmd->params, &n) || race_steps(n) < RACE_MIN_STEPS) {
+        return 0;
+    }
+
+    int idle = 0;
+    for (int i = 1; i < d->size; i++) {
+        idle += d->worker_status[i] == 0;
+    }
+    int race;
+    for (race = 0; race < MAX_RACES && d->races[race].attempts_left > 0; race++) {
+    }
+    if (idle < 2 || race == MAX_RACES) {
+        return 0;
+    }
+
+    FactorRace *job = &d->races[race];
+    job->cmd = *cmd;
+    job->attempts_left = idle;
+    job->answered = 0;
+
+    char race_msg[256];
+    sprintf(race_msg, "Raced on %d idle workers", idle);
+    write_to_log(d->log_file, cmd->client, "DISPATCHED", race_msg);
+
+    Command attempt = *cmd;
+    attempt.type = CMD_FACTOR_RACE;
+    int first_c = 1;
+    for (int i = 1; i < d->size; i++) {
+        if (d->worker_status[i] == 0) {
+            snprintf(attempt.params, sizeof(attempt.params), "%llu %d %d", n, first_c++, idle);
+            send_command(d, i, &attempt, race);
+        }
+    }
+    return 1;
+}
+
+void handle_matrix_operation(Command* cmd, Dispatcher* d) {
+    int size = d->size;
+    FILE* log_file = d->log_file;
     char size_str[32], file1[256], file2[256];
     sscanf(cmd->params, "%s %s %s", size_str, file1, file2);
     int matrix_size = atoi(size_str);
@@ -302,73 +1422,66 @@ void handle_matrix_operation(Command* cmd, int* worker_status, int size, FILE* l
         write_to_log(log_file, cmd->client, "COMPLETED", log_msg);
     } else {
         // Wait for all workers to be free before starting parallel operation
-        int all_workers_free = 0;
-        while (!all_workers_free) {
-            all_workers_free = 1;
-            for (int i = 1; i < size; i++) {
-                if (worker_status[i] == 1) {
-                    all_workers_free = 0;
-                    break;
-                }
-            }
-            if (!all_workers_free) {
-                check_completed_work(worker_status, size, log_file);
-                usleep(10000);
-            }
+        while (busy_workers(d) > 0) {
+            wait_for_results(d, -1);
         }
         
-        // Parallel processing for large matrices
-        int num_workers = size - 1;
-        int rows_per_worker = matrix_size / num_workers;
-        int extra_rows = matrix_size % num_workers;
+        // Parallel processing for large matrices, every worker gets a block of rows
+        int* counts = malloc(size * sizeof(int));
+        int* displs = malloc(size * sizeof(int));
+        matrix_row_counts(matrix_size, size, counts, displs);
         
         // Mark all workers as busy
         for (int i = 1; i < size; i++) {
-            worker_status[i] = 1;
+            d->worker_status[i] = 1;
         }
         
-        // Send matrices and work distribution to workers
+        // The command takes every worker into handle_parallel_matrix_operation
         for (int i = 1; i < size; i++) {
-            // Calculate rows for this worker
-            int worker_rows = rows_per_worker + (extra_rows > 0 ? 1 : 0);
-            extra_rows--;
-            
-            int start_row = (i - 1) * rows_per_worker + 
-                           (extra_rows > 0 ? extra_rows : 0);
-            int end_row = start_row + worker_rows;
-            
-            // Send operation parameters
-            MPI_Send(&matrix_size, 1, MPI_INT, i, TAG_WORK, MPI_COMM_WORLD);
-            MPI_Send(&cmd->type, 1, MPI_INT, i, TAG_WORK + 1, MPI_COMM_WORLD);
-            
-            // Send matrices
-            MPI_Send(matrix1, matrix_size * matrix_size, MPI_DOUBLE, i, 
-                    TAG_WORK + 2, MPI_COMM_WORLD);
-            MPI_Send(matrix2, matrix_size * matrix_size, MPI_DOUBLE, i, 
-                    TAG_WORK + 3, MPI_COMM_WORLD);
+            MPI_Send(cmd, sizeof(Command), MPI_CHAR, i, TAG_WORK, MPI_COMM_WORLD);
+        }
+        
+        int algorithm = cmd->type == CMD_MATRIXMULT ? choose_matrix_algorithm(matrix_size, size - 1) : MATRIX_ROWS;
+        double start = MPI_Wtime();
+        int header[3] = {matrix_size, cmd->type, algorithm};
+        MPI_Bcast(header, 3, MPI_INT, 0, MPI_COMM_WORLD);
+        if (algorithm == MATRIX_SUMMA) {
+            summa_master(matrix_size, size, matrix1, matrix2, result);
+        } else {
+            MPI_Scatterv(matrix1, counts, displs, MPI_DOUBLE, NULL, 0, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+            if (cmd->type == CMD_MATRIXADD) {
+                // Addition only needs the same rows of B
+                MPI_Scatterv(matrix2, counts, displs, MPI_DOUBLE, NULL, 0, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+            } else {
+                MPI_Bcast(matrix2, matrix_size * matrix_size, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+            }
             
-            // Send work range
-            int work_info[2] = {start_row, end_row};
-            MPI_Send(work_info, 2, MPI_INT, i, TAG_WORK + 4, MPI_COMM_WORLD);
+            // The blocks of rows land in place in the result
+            MPI_Gatherv(NULL, 0, MPI_DOUBLE, result, counts, displs, MPI_DOUBLE, 0, MPI_COMM_WORLD);
         }
+        double elapsed = MPI_Wtime() - start;
         
-        // Wait for all workers to complete
         for (int i = 1; i < size; i++) {
-            MPI_Status status;
-            int worker_rows[2];
-            MPI_Recv(worker_rows, 2, MPI_INT, i, TAG_RESULT, MPI_COMM_WORLD, &status);
-            
-            int start_row = worker_rows[0];
-            int end_row = worker_rows[1];
-            int result_size = (end_row - start_row) * matrix_size;
-            
-            // Receive partial results
-            MPI_Recv(&result[start_row * matrix_size], result_size, MPI_DOUBLE, 
-                    i, TAG_RESULT + 1, MPI_COMM_WORLD, &status);
-            
-            // Mark worker as free
-            worker_status[i] = 0;
+            d->worker_status[i] = 0;
         }
+        free(counts);
+        free(displs);
+        
+        // Matrix bytes that reach the workers and come back, against sending both full matrices to each
+        double matrix_bytes = (double)matrix_size * matrix_size * sizeof(double);
+        double moved = matrix_bytes * (cmd->type == CMD_MATRIXADD ? 3 : 2 + (size - 1));
+        double full_copies = matrix_bytes * (2 * (size - 1) + 1);
+        char algorithm_name[64] = "row blocks";
+        if (algorithm == MATRIX_SUMMA) {
+            // A, B and C pass the master once, every panel goes to the rest of its grid row or column
+            int grid_rows, grid_cols;
+            matrix_grid(size - 1, &grid_rows, &grid_cols);
+            moved = matrix_bytes * (grid_rows + grid_cols + 1);
+            snprintf(algorithm_name, sizeof(algorithm_name), "SUMMA on a %dx%d grid", grid_rows, grid_cols);
+        }
+        snprintf(log_msg, sizeof(log_msg), "%s, %.1f KB moved instead of %.1f KB with full copies, %.3f s",
+                 algorithm_name, moved / 1024, full_copies / 1024, elapsed);
+        write_to_log(log_file, cmd->client, "TRANSFER", log_msg);
         
         // Write final result
         char result_file[512];
@@ -386,43 +1499,42 @@ void handle_matrix_operation(Command* cmd, int* worker_status, int size, FILE* l
     free(result);
 }
 
-// Modified worker function to handle improved matrix operations
+// Worker side of a parallel matrix operation, it only holds its own rows (and B for a product)
 void handle_parallel_matrix_operation(int rank) {
-    MPI_Status status;
-    
-    // Receive matrix size
-    int matrix_size;
-    MPI_Recv(&matrix_size, 1, MPI_INT, 0, TAG_WORK, MPI_COMM_WORLD, &status);
-    
-    // Receive operation type
-    int operation;
-    MPI_Recv(&operation, 1, MPI_INT, 0, TAG_WORK + 1, MPI_COMM_WORLD, &status);
-    
-    // Allocate and receive matrices
-    double* matrix1 = malloc(matrix_size * matrix_size * sizeof(double));
-    double* matrix2 = malloc(matrix_size * matrix_size * sizeof(double));
-    
-    MPI_Recv(matrix1, matrix_size * matrix_size, MPI_DOUBLE, 0, 
-            TAG_WORK + 2, MPI_COMM_WORLD, &status);
-    MPI_Recv(matrix2, matrix_size * matrix_size, MPI_DOUBLE, 0, 
-            TAG_WORK + 3, MPI_COMM_WORLD, &status);
+    int header[3];
+    MPI_Bcast(header, 3, MPI_INT, 0, MPI_COMM_WORLD);
+    int matrix_size = header[0];
+    int operation = header[1];
+    if (header[2] == MATRIX_SUMMA) {
+        summa_worker(matrix_size, rank);
+        return;
+    }
     
-    // Receive work chunk information
-    int work_info[2];
-    MPI_Recv(work_info, 2, MPI_INT, 0, TAG_WORK + 4, MPI_COMM_WORLD, &status);
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    int* counts = malloc(size * sizeof(int));
+    int* displs = malloc(size * sizeof(int));
+    matrix_row_counts(matrix_size, size, counts, displs);
+    int rows = counts[rank] / matrix_size;
     
-    int start_row = work_info[0];
-    int end_row = work_info[1];
-    int result_size = (end_row - start_row) * matrix_size;
+    double* matrix1 = malloc(counts[rank] * sizeof(double));
+    double* partial_result = malloc(counts[rank] * sizeof(double));
+    MPI_Scatterv(NULL, counts, displs, MPI_DOUBLE, matrix1, counts[rank], MPI_DOUBLE, 0, MPI_COMM_WORLD);
     
-    // Allocate result array
-    double* partial_result = calloc(matrix_size * matrix_size, sizeof(double));
+    double* matrix2;
+    if (operation == CMD_MATRIXADD) {
+        matrix2 = malloc(counts[rank] * sizeof(double));
+        MPI_Scatterv(NULL, counts, displs, MPI_DOUBLE, matrix2, counts[rank], MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    } else {
+        matrix2 = malloc(matrix_size * matrix_size * sizeof(double));
+        MPI_Bcast(matrix2, matrix_size * matrix_size, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    }
     
-    // Create task structure
+    // Rows are numbered from 0 within the block
     ParallelMatrixTask task = {
         .size = matrix_size,
-        .start_row = start_row,
-        .end_row = end_row,
+        .start_row = 0,
+        .end_row = rows,
         .matrix1 = matrix1,
         .matrix2 = matrix2,
         .result = partial_result
@@ -435,14 +1547,11 @@ void handle_parallel_matrix_operation(int rank) {
         parallel_matrix_mult(&task);
     }
     
-    // Send back row information
-    MPI_Send(work_info, 2, MPI_INT, 0, TAG_RESULT, MPI_COMM_WORLD);
-    
-    // Send partial result
-    MPI_Send(&partial_result[start_row * matrix_size], result_size, MPI_DOUBLE, 
-            0, TAG_RESULT + 1, MPI_COMM_WORLD);
+    MPI_Gatherv(partial_result, counts[rank], MPI_DOUBLE, NULL, NULL, NULL, MPI_DOUBLE, 0, MPI_COMM_WORLD);
     
     // Cleanup
+    free(counts);
+    free(displs);
     free(matrix1);
     free(matrix2);
     free(partial_result);
@@ -499,13 +1608,39 @@ int parse_command(const char *line, Command *cmd) {
 
 void run_worker(int rank) {
     printf("Worker %d started\n", rank);
+    init_matrix_grid(rank);
     Command cmd;
-    char result[MAX_RESULT_LEN];
-    char final_result[MAX_RESULT_LEN];
-    MPI_Status status;
+    char result[MAX_RESULT_LEN];      // fixed size results (PRIMES, PRIMEDIVISORS)
+    ResultStream stream = {0};        // reused for every result, its buffer only grows
+
+    // Commands the master sent ahead, the receive of the next one is always posted
+    Command queue[MAX_PREFETCH + 1]; // the termination command can come on top of a full queue
+    int queue_head = 0, queue_count = 0;
+    Command incoming;
+    MPI_Request incoming_request;
+    MPI_Irecv(&incoming, sizeof(Command), MPI_CHAR, 0, TAG_WORK, MPI_COMM_WORLD, &incoming_request);
+    int receiving = 1;
 
     while (1) {
-        MPI_Recv(&cmd, sizeof(Command), MPI_CHAR, 0, TAG_WORK, MPI_COMM_WORLD, &status);
+        // Move everything that arrived into the queue, block only when there is nothing to do
+        int flag = 1;
+        while (receiving && flag) {
+            if (queue_count == 0) {
+                MPI_Wait(&incoming_request, MPI_STATUS_IGNORE);
+            } else {
+                MPI_Test(&incoming_request, &flag, MPI_STATUS_IGNORE);
+            }
+            if (flag) {
+                queue[(queue_head + queue_count++) % (MAX_PREFETCH + 1)] = incoming;
+                receiving = incoming.type != -1; // nothing comes after it
+                if (receiving) {
+                    MPI_Irecv(&incoming, sizeof(Command), MPI_CHAR, 0, TAG_WORK, MPI_COMM_WORLD, &incoming_request);
+                }
+            }
+        }
+        cmd = queue[queue_head];
+        queue_head = (queue_head + 1) % (MAX_PREFETCH + 1);
+        queue_count--;
 
         if (cmd.type == -1) {
             printf("Worker %d received termination signal\n", rank);
@@ -513,48 +1648,62 @@ void run_worker(int rank) {
         }
 
         memset(result, 0, MAX_RESULT_LEN);
+        stream_begin(&stream, cmd.client);
 
         printf("CMD TYPE %d and PARAMS %s\n", cmd.type, cmd.params);  
         
         switch (cmd.type) {
             case CMD_PRIMES:
                 printf("Worker %d processing PRIMES command\n", rank);
-                count_primes(atoi(cmd.params), result);
+                count_primes(atoll(cmd.params), result);
                 break;
                 
-            case CMD_PRIMEDIVISORS:
+            case CMD_PRIMEDIVISORS: {
                 printf("Worker %d processing PRIMEDIVISORS command\n", rank);
-                count_prime_divisors(atoi(cmd.params), result);
+                unsigned long long n;
+                if (parse_factor_number(cmd.params, &n)) {
+                    count_prime_divisors(n, 1, 1, result);
+                } else {
+                    sprintf(result, "PRIMEDIVISORS supports whole numbers from 0 to %llu", ULLONG_MAX);
+                }
+                break;
+            }
+
+            case CMD_FACTOR_RACE: {
+                printf("Worker %d racing PRIMEDIVISORS\n", rank);
+                unsigned long long n, first_c, c_step;
+                sscanf(cmd.params, "%llu %llu %llu", &n, &first_c, &c_step);
+                count_prime_divisors(n, first_c, c_step, result);
                 break;
+            }
                 
             case CMD_ANAGRAMS:
                 printf("Worker %d processing ANAGRAMS command\n", rank);
                 char word[192];
                 strncpy(word, cmd.params, sizeof(word) - 1);
                 word[sizeof(word) - 1] = '\0';
-                strcpy(result, "Anagrams: ");
-                int count = 0;
-                generate_anagrams(word, 0, strlen(word) - 1, result, &count);
+                stream_append(&stream, "Anagrams: ", 10);
+                generate_anagrams(word, &stream);
                 break;
 
             case CMD_MATRIXADD:
             case CMD_MATRIXMULT:
                 handle_parallel_matrix_operation(rank);
-                break;
+                continue; // the rows went back with MPI_Gatherv, the master logs the job
             
         }
 
-        // Format final result with client ID
-        snprintf(final_result, MAX_RESULT_LEN, "CLIENT:%s RESULT:%s", cmd.client, result);
-        
-        MPI_Send(final_result, MAX_RESULT_LEN, MPI_CHAR, 0, TAG_RESULT, MPI_COMM_WORLD);
+        stream_append(&stream, result, strlen(result));
+        stream_finish(&stream);
         printf("Worker %d sent result\n", rank);
     }
 
+    free(stream.text.data);
+    free_matrix_grid();
     printf("Worker %d finished\n", rank);
 }
 
-void run_server(int size, const char *cmd_filename) {
+void run_server(int size, const char *cmd_filename, int prefetch, const char *cache_path) {
     FILE *cmd_file = fopen(cmd_filename, "r");
     FILE *log_file = fopen("dispatcher.log", "w");
     
@@ -564,11 +1713,21 @@ void run_server(int size, const char *cmd_filename) {
         return;
     }
 
-    printf("Main server started with %d workers\n", size - 1);
+    printf("Main server started with %d workers, %d commands in flight per worker\n", size - 1, prefetch);
     fprintf(log_file, "Server started with %d workers\n", size - 1);
     fflush(log_file);
 
-    int *worker_status = calloc(size, sizeof(int));
+#ifdef VERIFY_PRIMES
+    long long mismatch = verify_prime_counting(PRIMES_VERIFY_LIMIT);
+    if (mismatch >= 0) {
+        printf("Prime counting differs from trial division at n = %lld\n", mismatch);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+        return;
+    }
+#endif
+
+    Dispatcher d;
+    init_dispatcher(&d, size, prefetch, log_file, cache_path);
     char line[MAX_CMD_LEN];
     Command cmd;
 
@@ -580,10 +1739,11 @@ void run_server(int size, const char *cmd_filename) {
                 int wait_time = atoi(cmd.params);
                 printf("Waiting for %d seconds...\n", wait_time);
                 
-                time_t start_time = time(NULL);
-                while (time(NULL) - start_time < wait_time) {
-                    check_completed_work(worker_status, size, log_file);
-                    usleep(10000);
+                // Results are still handled as they come in while waiting
+                double deadline = MPI_Wtime() + wait_time;
+                double now;
+                while ((now = MPI_Wtime()) < deadline) {
+                    wait_for_results(&d, deadline - now);
                 }
                 continue;
             }
@@ -593,59 +1753,67 @@ void run_server(int size, const char *cmd_filename) {
 
             // Handle matrix operations separately
             if (cmd.type == CMD_MATRIXADD || cmd.type == CMD_MATRIXMULT) {
-                handle_matrix_operation(&cmd, worker_status, size, log_file);
+                handle_matrix_operation(&cmd, &d);
             } else {
                 // Handle non-matrix operations
-                int worker = -1;
-                while (worker == -1) {
-                    check_completed_work(worker_status, size, log_file);
-                    
-                    for (int i = 1; i < size; i++) {
-                        if (worker_status[i] == 0) {
-                            worker = i;
-                            worker_status[i] = 1;
-                            break;
-                        }
-                    }
-                    
-                    if (worker == -1) {
-                        usleep(10000);
-                    }
+                wait_for_results(&d, 0); // log what is already done
+
+                const char *cached = cache_lookup(&d.cache, &cmd);
+                if (cached) {
+                    char *hit_msg = malloc(strlen(cached) + 16);
+                    sprintf(hit_msg, "%s (cache hit)", cached);
+                    write_to_log(log_file, cmd.client, "COMPLETED", hit_msg);
+                    write_result_to_file(cmd.client, cached);
+                    free(hit_msg);
+                    continue;
+                }
+
+                if (cmd.type == CMD_PRIMEDIVISORS && dispatch_race(&d, &cmd)) {
+                    continue;
+                }
+
+                int worker;
+                while ((worker = pick_worker(&d)) == -1) {
+                    wait_for_results(&d, -1); // sleeps until a worker is done
                 }
 
                 char dispatch_msg[256];
-                sprintf(dispatch_msg, "Dispatched to worker %d", worker);
+                sprintf(dispatch_msg, "Dispatched to worker %d (%d in flight)", worker, d.worker_status[worker] + 1);
                 write_to_log(log_file, cmd.client, "DISPATCHED", dispatch_msg);
                 printf("Dispatching to worker %d\n", worker);
 
-                MPI_Send(&cmd, sizeof(Command), MPI_CHAR, worker, TAG_WORK, MPI_COMM_WORLD);
+                send_command(&d, worker, &cmd, -1);
             }
         }
     }
 
     // Wait for all workers to complete their tasks
-    int all_complete = 0;
-    while (!all_complete) {
-        check_completed_work(worker_status, size, log_file);
-        
-        all_complete = 1;
-        for (int i = 1; i < size; i++) {
-            if (worker_status[i] == 1) {
-                all_complete = 0;
-                break;
-            }
-        }
-        usleep(10000);
+    while (busy_workers(&d) > 0) {
+        wait_for_results(&d, -1);
     }
 
+    double elapsed = d.last_completion - d.first_dispatch;
+    char stats[256];
+    snprintf(stats, sizeof(stats), "%ld jobs completed in %.3f s (%.1f jobs/s, %d in flight per worker)",
+             d.jobs_completed, elapsed, elapsed > 0 ? d.jobs_completed / elapsed : 0.0, prefetch);
+    printf("%s\n", stats);
+    write_to_log(log_file, "SYSTEM", "STATS", stats);
+
+    ResultCache *cache = &d.cache;
+    snprintf(stats, sizeof(stats), "%ld hits of %ld lookups (%.1f%% hit rate), %d results cached",
+             cache->hits, cache->lookups, cache->lookups > 0 ? 100.0 * cache->hits / cache->lookups : 0.0,
+             cache->entries);
+    printf("Cache: %s\n", stats);
+    write_to_log(log_file, "SYSTEM", "CACHE", stats);
+
     // Send termination signal to all workers
     printf("Sending termination signal to workers...\n");
+    free_dispatcher(&d);
     cmd.type = -1;
     for (int i = 1; i < size; i++) {
         MPI_Send(&cmd, sizeof(Command), MPI_CHAR, i, TAG_WORK, MPI_COMM_WORLD);
     }
 
-    free(worker_status);
     fclose(cmd_file);
     fclose(log_file);
     printf("Main server finished\n");
@@ -658,13 +1826,17 @@ int main(int argc, char *argv[]) {
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
+    // The workers on their own, for the SUMMA grid
+    MPI_Comm_split(MPI_COMM_WORLD, rank == 0 ? MPI_UNDEFINED : 0, rank, &worker_comm);
+
     if (rank == 0) { 
-        if (argc != 2) { 
-            printf("Usage: %s <command_file>\n", argv[0]);
+        int prefetch = argc >= 3 ? atoi(argv[2]) : DEFAULT_PREFETCH;
+        if (argc < 2 || argc > 4 || prefetch < 1 || prefetch > MAX_PREFETCH) { 
+            printf("Usage: %s <command_file> [commands in flight per worker, 1..%d] [result cache file]\n", argv[0], MAX_PREFETCH);
             MPI_Abort(MPI_COMM_WORLD, 1);
             return 1;
         }
-        run_server(size, argv[1]);
+        run_server(size, argv[1], prefetch, argc == 4 ? argv[3] : NULL);
     } else {
         run_worker(rank);
     }
@@ -0,0 +1,38 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define ARENA_ALIGNMENT 16
+#define ARENA_HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+#define ARENA_MIN_BLOCK (1UL * 1024 * 1024)
+
+/*
+    A block is one anonymous mapping. The first block is sized up front from the
+    expected amount of per-phase data, extra blocks are only chained when that estimate
+    turns out to be too small (for example when tourney sets grow more than expected).
+*/
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    char* base;
+    size_t size;     // size of the mapping
+    size_t used;     // bytes handed out from this block
+    bool hugetlb;    // mapped with MAP_HUGETLB (explicit huge pages)
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock* head;      // block we are currently allocating from
+    ArenaBlock* first;     // the sized block, kept on reset
+    size_t capacity;       // requested capacity of the first block
+    size_t allocated;      // bytes handed out over all blocks
+} Arena;
+
+int arena_init(Arena* arena, size_t capacity);
+void* arena_alloc(Arena* arena, size_t size);
+char* arena_strdup(Arena* arena, const char* str);
+void arena_reset(Arena* arena);
+void arena_release(Arena* arena);
+int arena_prepare(Arena* arena, size_t capacity);
+
+#endif // ARENA_H
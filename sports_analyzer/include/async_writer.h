@@ -0,0 +1,23 @@
+#ifndef ASYNC_WRITER_H
+#define ASYNC_WRITER_H
+
+#include <stddef.h>
+
+#define ASYNC_WRITER_BUFFER (1 << 20) // per appended file, written out when full or at a sync
+#define ASYNC_WRITER_MAX_FILES 16     // files open in the writer at the same time
+
+/*
+    Reports and the performance log are formatted in memory by the thread that produces them
+    and handed to one writer thread through a lock-free queue, so no pipeline thread ever waits
+    for the disk. Paths are kept by pointer and must stay valid until the writer is stopped
+    (string literals, the sport descriptors). Every call falls back to a synchronous write
+    when the writer is not running
+*/
+void async_writer_start(void);
+void async_writer_append(const char* path, const char* data, size_t length);
+void async_writer_replace(const char* path, const char* data, size_t length);
+void async_writer_sync(void);
+void async_writer_sync_wait(void);
+void async_writer_stop(void);
+
+#endif // ASYNC_WRITER_H
@@ -1,6 +1,7 @@
 #ifndef CONSUMER_H
 #define CONSUMER_H
 
+#include <time.h>
 #include "utils.h"
 
 typedef struct {
@@ -9,9 +10,7 @@ typedef struct {
 } ConsumerArgs;
 
 void* consumer_thread(void* arg);
-void calculate_ppa_for_tennis(SharedBuffer *buffer, char* filename, char* data);
-void calculate_ppa_for_football(SharedBuffer *buffer, char* filename, char* data);
-void calculate_max_points_for_football(SharedBuffer *buffer, char *filename, char *data);
-void calculate_max_points_for_tennis(SharedBuffer *buffer, char *filename, char *data);
+void aggregate_row(SharedBuffer* buffer, int sport, bool ranking, const char* data);
+void add_aggregation_time(SharedBuffer* buffer, int sport, bool ranking, const struct timespec* started, long rows);
 
 #endif // CONSUMER_H
\ No newline at end of file
@@ -0,0 +1,61 @@
+#ifndef DATE_INDEX_H
+#define DATE_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define RANKING_LOG_CHUNK 16384
+#define DATE_INDEX_THREADS 4
+
+/*
+    One ranking row as seen by the points consumer. The log is what the date index is
+    built from, so time range queries never have to read the CSV files again
+*/
+typedef struct {
+    int player;       // index in the phase player table
+    int month;        // year * 12 + (month - 1) of the ranking date
+    int points;
+    int new_tourney;  // 1 the first time this ranking date is counted for the player
+} RankingRecord;
+
+typedef struct RankingLogChunk {
+    struct RankingLogChunk* next;
+    int count;
+    RankingRecord records[RANKING_LOG_CHUNK];
+} RankingLogChunk;
+
+typedef struct {
+    RankingLogChunk* head;
+    RankingLogChunk* tail;
+    long count;
+    bool truncated;  // a chunk was refused by the memory budget, the log is incomplete
+} RankingLog;
+
+// One month partition of a player, with prefix sums over all the player's months up to this one
+typedef struct {
+    int month;
+    int tourneys;
+    long long points;
+} MonthPartition;
+
+typedef struct {
+    bool built;
+    int player_count;
+    int* offsets;                // first partition of each player
+    int* counts;                 // number of month partitions of each player
+    MonthPartition* partitions;  // grouped by player, sorted by month
+    size_t bytes;                // size of the three arrays above
+} DateIndex;
+
+int date_to_month(int date);
+bool ranking_log_needs_chunk(const RankingLog* log);
+void ranking_log_add_chunk(RankingLog* log, RankingLogChunk* chunk);
+void ranking_log_append(RankingLog* log, int player, int date, int points, bool new_tourney);
+void date_index_sizes(const RankingLog* log, int player_count, size_t* index_bytes, size_t* build_bytes);
+int build_date_index(DateIndex* index, const RankingLog* log, int player_count);
+void free_date_index(DateIndex* index);
+bool date_index_range(const DateIndex* index, int player, int from_date, int to_date,
+                      long long* points, int* tourneys);
+int date_index_best_average(const DateIndex* index, int from_date, int to_date, double* best_avg);
+
+#endif // DATE_INDEX_H
@@ -0,0 +1,13 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "utils.h"
+
+#define NUM_PRODUCERS 1
+#define DEFAULT_WORKERS 2   // consumer workers when --threads is not given
+#define MAX_WORKERS 64
+#define BUFFER_SIZE 1000
+
+int run_analyzer(const AnalyzerOptions* options, double* elapsed_seconds);
+
+#endif // ENGINE_H
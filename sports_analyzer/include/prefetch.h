@@ -0,0 +1,39 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define PREFETCH_WINDOW 2      // files read ahead of the one being parsed, --prefetch changes it
+#define PREFETCH_MAX_WINDOW 64
+#define PREFETCH_PATH 1024
+
+/*
+    Keeps the next files of a directory walk in the page cache while the producer parses the
+    current one. Without a thread the producer asks the kernel with posix_fadvise(WILLNEED) as
+    it moves on, the kernel then reads in the background. With a thread (--prefetch-thread) an
+    idle priority thread reads the window with readahead(), which also works on file systems
+    that ignore the advice
+*/
+typedef struct {
+    const char (*paths)[PREFETCH_PATH];
+    int count;
+    int window;
+    bool threaded;
+    int current;           // file the producer is parsing
+    int next;              // first file not prefetched yet
+    bool stop;
+    pthread_mutex_t mutex;
+    pthread_cond_t moved;  // current moved on or stop was set
+    pthread_t thread;
+    int files;             // files prefetched
+    size_t bytes;
+} Prefetcher;
+
+void prefetch_start(Prefetcher* prefetcher, const char (*paths)[PREFETCH_PATH], int count, int window, bool threaded);
+void prefetch_advance(Prefetcher* prefetcher, int current);
+void prefetch_stop(Prefetcher* prefetcher);
+size_t drop_cached_files(const char* dir_path, int* files);
+
+#endif // PREFETCH_H
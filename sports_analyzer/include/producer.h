@@ -3,11 +3,36 @@
 
 #include "utils.h"
 
+// Files at least this big are parsed by several threads, one newline aligned byte range each
+#ifndef PARALLEL_PARSE_MIN_BYTES
+#define PARALLEL_PARSE_MIN_BYTES (8L * 1024 * 1024)
+#endif
+#define PARSE_THREADS 4
+#define CHUNK_TASK_BYTES (64L * 1024) // steal schedule: CSV files are cut into tasks of about this size
+#define ZIP_THREADS 4   // zip members decompressed at the same time
+
 typedef struct {
     SharedBuffer* buffer;
     int producer_id;
 } ProducerArgs;
 
+typedef struct {
+    const char* file_path;
+    SharedBuffer* buffer;
+    long start;   // first byte of the range
+    long end;     // lines starting at or after this byte belong to the next range
+    int sport;    // sport of the file, -1 if it is outside the data directories
+    bool ranking; // ranking file, otherwise matches
+    int rows;     // rows pushed to the buffer
+} CsvRange;
+
 void* producer_thread(void* arg);
+void process_csv_file(const char* file_path, SharedBuffer* buffer);
+void search_csv_files(const char* dir_path, SharedBuffer* buffer);
+void process_zip_archive(const char* archive_path, SharedBuffer* buffer);
+void read_players_in_shared_buffer(SharedBuffer *buffer, int sport);
+void generate_phase_report(SharedBuffer* buffer, ReportCallback callback, int sport);
+void start_phase_batch(SharedBuffer* buffer, ProcessingPhase phase);
+void finish_phase_batch(SharedBuffer* buffer);
 
 #endif // PRODUCER_H
\ No newline at end of file
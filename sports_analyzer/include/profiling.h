@@ -6,17 +6,83 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
 
-#define MAX_HOTSPOTS 10
+#define MAX_HOTSPOTS 16
 #define MAX_NAME_LENGTH 50
+#define MAX_MEMORY_PHASES 4
+#define MAX_TAIL_PHASES 8
+#define PROFILE_LOG "performance_log.txt"
+
+// Sampling profiler (--sample-profile), see sampler_start
+#define SAMPLER_DEFAULT_HZ 1000
+#define SAMPLER_MAX_FRAMES 32
+#define SAMPLER_MAX_SAMPLES (1 << 17)
+#define SAMPLER_MAX_THREADS 64
+#define SAMPLER_OUTPUT "profile.folded"
+
+// Who owns tracked memory, see memory_reserve
+typedef enum {
+    MEM_RING_ENTRIES,   // producer/consumer ring
+    MEM_PLAYER_TABLE,   // players of the phase and their names
+    MEM_TOURNEY_SETS,   // per player tourney sets (old sets stay in the arena when a set grows)
+    MEM_PLAYER_INDEX,   // player_id index
+    MEM_DATE_INDEX,     // ranking log and month partitions
+    MEM_REPORT_TEMP,    // temporaries while a report is written
+    MEM_QUERY_SERVER,   // published phases and their query indexes
+    MEM_SUBSYSTEM_COUNT
+} MemorySubsystem;
+
+typedef enum {
+    BUDGET_ABORT,   // stop the run when the budget is exceeded
+    BUDGET_DEGRADE  // skip optional structures (date index, query indexes) instead
+} BudgetPolicy;
+
+typedef struct {
+    size_t current;
+    size_t peak;        // whole run
+    size_t phase_peak;  // since the current phase started
+} MemoryAccount;
+
+typedef struct {
+    char name[MAX_NAME_LENGTH];
+    size_t peak[MEM_SUBSYSTEM_COUNT];
+    size_t total_peak;
+} MemoryPhase;
 
 typedef struct {
     char name[MAX_NAME_LENGTH];
-    struct timespec start;
     double total_time;
     int count;
 } HotspotData;
 
+// Worker idle time at the end of one batch, see scheduler_tail_idle
+typedef struct {
+    char name[MAX_NAME_LENGTH];
+    int workers;
+    double span;           // seconds from the start of the batch until the last worker finished
+    double idle_total;     // seconds the workers waited for the last one, summed over the workers
+    double idle_max;
+    unsigned long tasks;   // chunk tasks taken (steal schedule)
+    unsigned long steals;  // of them taken from another worker
+} TailIdle;
+
+#define HANDOFF_HISTOGRAM_BUCKETS 10 // batch sizes 1, 2-3, 4-7, ... 512+
+
+// Producer/consumer handoff batches, see adapt_batch_size
+typedef struct {
+    int bound_min;              // configured bounds
+    int bound_max;
+    int current;                // batch size in use
+    int smallest;               // smallest and largest size chosen so far
+    int largest;
+    unsigned long adjustments;
+    unsigned long batches;      // batches taken by the consumers, updated with atomics
+    unsigned long rows;
+    unsigned long histogram[HANDOFF_HISTOGRAM_BUCKETS]; // batches taken by size
+} HandoffStats;
+
 typedef struct {
     struct timeval start_time;
     struct timespec wall_start;
@@ -28,6 +94,21 @@ typedef struct {
     
     // Hotspot tracking
     HotspotData hotspots[MAX_HOTSPOTS];
+
+    HandoffStats handoff;
+    TailIdle tail_idle[MAX_TAIL_PHASES]; // first finished batches
+    int tail_idle_count;
+
+    // Memory accounting, tracked bytes only (ru_maxrss above also counts everything else)
+    MemoryAccount memory[MEM_SUBSYSTEM_COUNT];
+    size_t memory_total;
+    size_t memory_phase_peak;
+    char memory_phase[MAX_NAME_LENGTH];        // current phase, empty when none
+    MemoryPhase memory_phases[MAX_MEMORY_PHASES]; // finished phases
+    int memory_phase_count;
+    size_t memory_budget;                      // bytes, 0 = no budget
+    BudgetPolicy budget_policy;
+    int budget_degradations;                   // optional allocations skipped
     
     pthread_mutex_t profile_mutex;
 } ProfilerData;
@@ -41,5 +122,19 @@ void calculate_metrics(ProfilerData* profiler);
 // New hotspot tracking functions
 void start_hotspot(ProfilerData* profiler, const char* name);
 void end_hotspot(ProfilerData* profiler, const char* name);
+void add_hotspot_time(ProfilerData* profiler, const char* name, double elapsed, int count);
+
+// Memory accounting
+bool memory_reserve(ProfilerData* profiler, MemorySubsystem subsystem, size_t bytes, bool optional);
+void memory_release(ProfilerData* profiler, MemorySubsystem subsystem, size_t bytes);
+void memory_transfer(ProfilerData* profiler, MemorySubsystem from, MemorySubsystem to, size_t bytes);
+void memory_phase_begin(ProfilerData* profiler, const char* name);
+void record_tail_idle(ProfilerData* profiler, const TailIdle* tail);
+
+// Sampling profiler, every call is a no-op unless sampler_start succeeded
+int sampler_start(int hz);
+void sampler_thread_start(const char* name);
+void sampler_thread_stop(void);
+void sampler_write(const char* path);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,54 @@
+#ifndef QUERY_SERVER_H
+#define QUERY_SERVER_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include "utils.h"
+
+#define QUERY_MAX_LINE 512
+#define QUERY_DEFAULT_TOP_K 10
+#define QUERY_MAX_TOP_K 1000
+
+/*
+    Read-only view of a finished sport. It owns the phase arena the players live in,
+    the lookup tables and sorted rankings are built once when the phase is published
+*/
+typedef struct {
+    bool ready;
+    Arena arena;
+    Player* players;
+    int player_count;
+    int* player_index;             // player_id -> index + 1, same layout as SportState.player_index
+    unsigned int player_index_mask;
+    int* name_index;               // "first last" (case insensitive) -> index + 1
+    unsigned int name_index_mask;
+    int* by_ppa;                   // players with a PPA average, best first
+    int by_ppa_count;
+    int* by_points;                // players with ranking points, best average per tournament first
+    int by_points_count;
+    DateIndex date_index;          // per month prefix sums, for RANGE queries
+} SportIndex;
+
+typedef struct QueryServer {
+    char socket_path[108];
+    int listen_fd;
+    pthread_t accept_thread;
+
+    // Queries only read the indexes, the lock prefers readers so a burst of
+    // queries never waits behind another query, only behind a phase being published
+    pthread_rwlock_t lock;
+    SportIndex sports[SPORT_COUNT];
+
+    pthread_mutex_t clients_mutex;
+    pthread_cond_t clients_done;
+    int active_clients;
+
+    unsigned long queries;         // updated with atomics
+    unsigned long query_ns;
+} QueryServer;
+
+int query_server_start(QueryServer* server, const char* socket_path);
+void query_server_publish_phase(QueryServer* server, SharedBuffer* buffer, int sport);
+void query_server_wait(QueryServer* server);
+
+#endif // QUERY_SERVER_H
@@ -0,0 +1,64 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdbool.h>
+#include <pthread.h>
+#include "profiling.h"
+
+#define STEAL_TASKS_PER_WORKER 4 // queued tasks per worker before the producer waits
+
+/*
+    One piece of parsing work: a byte range of a CSV file or one member of a zip archive.
+    run parses it and aggregates its rows on the worker that took it, file is whatever the
+    submitter needs to find the data again (shared by the chunks of one file)
+*/
+typedef struct ChunkTask {
+    void (*run)(struct ChunkTask* task, void* context);
+    void* file;
+    long start;
+    long end;
+} ChunkTask;
+
+// Tasks of one worker, it works on the newest end, thieves take from the oldest end
+typedef struct {
+    ChunkTask* tasks;  // ring of capacity entries
+    int capacity;
+    int head;          // oldest task
+    int count;
+    pthread_mutex_t mutex;
+} TaskDeque;
+
+/*
+    Work stealing for the parse stage (--schedule steal). The producer deals the chunks of every
+    file round robin into the deques of the workers; a worker whose deque ran empty steals from
+    the others, starting at a random one. The tail of a phase then shrinks to about one chunk
+    instead of waiting on whichever worker got the rows of the biggest file last.
+    The worker clocks are kept in both schedules, they give the tail idle time of each batch
+*/
+typedef struct {
+    TaskDeque* deques;
+    int workers;
+    int next_deque;            // round robin position of the producer
+    int queued;                // tasks in all deques, under mutex
+    int queue_limit;
+    bool closed;               // no more tasks in this batch
+    bool producer_waiting;
+    pthread_mutex_t mutex;
+    pthread_cond_t work;       // tasks were queued or the batch was closed
+    pthread_cond_t room;       // queued fell below queue_limit
+    unsigned long tasks;       // taken in this batch
+    unsigned long steals;
+    long long batch_start;     // monotonic ns
+    long long* busy_until;     // per worker, end of the last work it did in this batch
+} TaskScheduler;
+
+bool scheduler_init(TaskScheduler* scheduler, int workers);
+void scheduler_destroy(TaskScheduler* scheduler);
+void scheduler_open(TaskScheduler* scheduler);
+void scheduler_submit(TaskScheduler* scheduler, const ChunkTask* task);
+void scheduler_close(TaskScheduler* scheduler);
+bool scheduler_take(TaskScheduler* scheduler, int worker, unsigned int* seed, ChunkTask* task);
+void scheduler_mark_busy(TaskScheduler* scheduler, int worker);
+void scheduler_tail_idle(TaskScheduler* scheduler, const char* name, TailIdle* tail);
+
+#endif // SCHEDULER_H
@@ -0,0 +1,97 @@
+#ifndef SPORT_H
+#define SPORT_H
+
+#include <stdbool.h>
+
+typedef enum {
+    SPORT_FOOTBALL,
+    SPORT_TENNIS,
+    SPORT_BASKETBALL,
+    SPORT_COUNT
+} SportId;
+
+// Values the aggregation kernel reads from a row, 0 marks a column nobody needs
+typedef enum {
+    FIELD_SKIP,
+    FIELD_WINNER_ID,
+    FIELD_LOSER_ID,
+    FIELD_W_ACE, FIELD_W_DF, FIELD_W_SVPT, FIELD_W_1ST_WON, FIELD_W_2ND_WON,
+    FIELD_L_ACE, FIELD_L_DF, FIELD_L_SVPT, FIELD_L_1ST_WON, FIELD_L_2ND_WON,
+    FIELD_RANKING_DATE,
+    FIELD_RANKING_PLAYER,
+    FIELD_RANKING_POINTS,
+    FIELD_COUNT
+} SportField;
+
+#define SPORT_MAX_COLUMNS 64
+
+typedef enum {
+    PPA_OWN,          // every player is credited with their own PPA of the match
+    PPA_DIFFERENTIAL  // the winner gets wPPA - lPPA, the loser lPPA - wPPA
+} PpaCredit;
+
+/*
+    Everything that differs between two sports: where the files are, which column holds which
+    value and how the PPA is computed and credited. The columns are stored as column -> field
+    maps, so a row is parsed in one left to right scan that stops after the last needed column
+*/
+typedef struct {
+    const char* name;            // "football", for --watch and the query server
+    const char* title;           // report heading
+    const char* data_dir;
+    const char* report_file;
+    const char* ranking_marker;  // files with this in their name hold ranking rows, all others matches
+    unsigned char match_fields[SPORT_MAX_COLUMNS];
+    int match_last_column;
+    unsigned char ranking_fields[SPORT_MAX_COLUMNS];
+    int ranking_last_column;
+    int df_sign;                 // +1: double faults add to the serve points, -1: they count against them
+    PpaCredit credit;
+    const char* phase_hotspot;
+    const char* ppa_hotspot;
+    const char* points_hotspot;
+} SportDescriptor;
+
+// tourney_id,tourney_name,surface,draw_size,tourney_level,tourney_date,match_num,winner_id,winner_seed,winner_entry,
+// winner_name,winner_hand,winner_ht,winner_ioc,winner_age,loser_id,loser_seed,loser_entry,loser_name,loser_hand,loser_ht,
+// loser_ioc,loser_age,score,best_of,round,minutes,w_ace,w_df,w_svpt,w_1stIn,w_1stWon,w_2ndWon,w_SvGms,w_bpSaved,w_bpFaced,
+// l_ace,l_df,l_svpt,l_1stIn,l_1stWon,l_2ndWon,l_SvGms,l_bpSaved,l_bpFaced,winner_rank,winner_rank_points,loser_rank,loser_rank_points
+#define ATP_MATCH_FIELDS { \
+    [7] = FIELD_WINNER_ID, [15] = FIELD_LOSER_ID, \
+    [27] = FIELD_W_ACE, [28] = FIELD_W_DF, [29] = FIELD_W_SVPT, [31] = FIELD_W_1ST_WON, [32] = FIELD_W_2ND_WON, \
+    [33] = FIELD_L_ACE, [34] = FIELD_L_DF, [35] = FIELD_L_SVPT, [37] = FIELD_L_1ST_WON, [38] = FIELD_L_2ND_WON }
+
+// ranking_date,rank,player,points
+#define ATP_RANKING_FIELDS { [0] = FIELD_RANKING_DATE, [2] = FIELD_RANKING_PLAYER, [3] = FIELD_RANKING_POINTS }
+
+/*
+    The table is defined in the header on purpose: every file that aggregates sees the
+    descriptors as constants, so the kernel in consumer.c is specialized for each sport
+    (dead columns and the other PPA variant are folded away) instead of reading the table per row
+*/
+static const SportDescriptor sport_descriptors[SPORT_COUNT] = {
+    [SPORT_FOOTBALL] = {
+        "football", "Football", "data/football", "football_report.txt", "atp_rankings",
+        ATP_MATCH_FIELDS, 38, ATP_RANKING_FIELDS, 3,
+        +1, PPA_OWN,
+        "football_phase", "football_ppa_calculation", "football_points_calculation"
+    },
+    [SPORT_TENNIS] = {
+        "tennis", "Tennis", "data/tennis", "tennis_report.txt", "atp_rankings",
+        ATP_MATCH_FIELDS, 38, ATP_RANKING_FIELDS, 3,
+        -1, PPA_DIFFERENTIAL,
+        "tennis_phase", "tennis_ppa_calculation", "tennis_points_calculation"
+    },
+    [SPORT_BASKETBALL] = {
+        "basketball", "Basketball", "data/basketball", "basketball_report.txt", "atp_rankings",
+        ATP_MATCH_FIELDS, 38, ATP_RANKING_FIELDS, 3,
+        -1, PPA_DIFFERENTIAL,
+        "basketball_phase", "basketball_ppa_calculation", "basketball_points_calculation"
+    },
+};
+
+int sport_by_name(const char* name);
+int sport_for_path(const char* path);
+bool sport_is_ranking_file(int sport, const char* path);
+
+#endif // SPORT_H
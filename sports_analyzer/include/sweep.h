@@ -0,0 +1,11 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "utils.h"
+
+#define SWEEP_DEFAULT_REPEAT 3
+#define SWEEP_OUTPUT "sweep_results.txt"
+
+int run_sweep(const AnalyzerOptions* options);
+
+#endif // SWEEP_H
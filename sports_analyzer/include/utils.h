@@ -5,46 +5,120 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include "profiling.h"
+#include "arena.h"
+#include "date_index.h"
+#include "sport.h"
+#include "prefetch.h"
+#include "scheduler.h"
 
-#define MAX_TOURNEYZ 2000
+#define INITIAL_TOURNEYZ 8
+
+// Fractional bits of the fixed point PPA sums. One match adds at most a few units, so even
+// millions of matches stay far below 2^63
+#define PPA_FIXED_BITS 40
+#define PPA_FIXED_ONE (1LL << PPA_FIXED_BITS)
+
+// Rows per producer/consumer handoff, adapted at runtime between --batch <min> <max>
+#define HANDOFF_BATCH_MIN 1
+#define HANDOFF_BATCH_MAX 128
+#define HANDOFF_BATCH_INITIAL 16
+#define HANDOFF_BATCH_LIMIT 256        // largest accepted --batch max, a quarter of the ring
+#define HANDOFF_ADAPT_INTERVAL 16      // batches a consumer takes between two decisions
+#define HANDOFF_TARGET_NS 1000000      // one batch should not keep a worker busy longer than this
 
 typedef struct {
     char data[1024];
-    char filename[1024];
+    int sport;    // SportId of the file the row came from, resolved once per file
+    bool ranking; // row of a ranking file, otherwise a match row
 } BufferEntry; 
 
+// The per sport phases share their values with SportId
 typedef enum {
-    PHASE_FOOTBALL,
-    PHASE_TENNIS,
+    PHASE_FOOTBALL = SPORT_FOOTBALL,
+    PHASE_TENNIS = SPORT_TENNIS,
+    PHASE_BASKETBALL = SPORT_BASKETBALL,
+    PHASE_ALL_SPORTS, // --single-pass: the rows of every sport in one batch
     PHASE_DONE
 } ProcessingPhase;
 
+// How the rows of the data files get to the workers (--schedule)
+typedef enum {
+    SCHEDULE_STEAL, // files are cut into chunk tasks, each worker parses and aggregates its own (see scheduler.h)
+    SCHEDULE_RING   // the producer parses every row into the shared ring, the workers aggregate them
+} ScheduleMode;
+
 typedef struct {
     int player_id;
-    char name_first[100];
-    char name_last[100];
+    char* name_first; // allocated from the phase arena
+    char* name_last;
     int points; // max points este calculat ca numarul total de puncte impartit la numarul de turnee
     int w_ace, w_df, w_svpt, w_1stWon, w_2ndWon; // for wPPA = (w_ace - w_df + w_1stWon + w_2ndWon) / w_svpt
     int l_ace, l_df, l_svpt, l_1stWon, l_2ndWon; // for lPPA = (l_ace - l_df + l_1stWon + l_2ndWon) / l_svpt
-    double ppa; // PPA = wPPA - lPPA -> ppa formula
-    char tourneyz[MAX_TOURNEYZ][20];
+    long long ppa; // PPA = wPPA - lPPA -> ppa formula, fixed point sum (see ppa_fixed)
+    int* tourneyz; // open addressing set of ranking dates (0 = empty slot), lives in the phase arena
+    int tourneyz_capacity;
     int tourneyz_count;
 } Player;
 
+typedef struct {
+    ProcessingPhase watch_phase; // sport watched with --watch, PHASE_DONE for a normal run
+    const char* serve_path;      // Unix socket of the query server (--serve), NULL for a normal run
+    int range_from;              // --range dates (YYYYMMDD), 0 when not asked for
+    int range_to;
+    size_t memory_budget;        // --memory-budget in bytes, 0 = no budget
+    BudgetPolicy budget_policy;
+    int sample_hz;               // --sample-profile rate, 0 = sampling profiler off
+    int threads;                 // consumer workers, 1 = serial run
+    int sweep_max;               // --sweep: largest worker count, 0 = no sweep
+    int sweep_repeat;            // runs per worker count in a sweep
+    bool single_pass;            // --single-pass: every sport is loaded and aggregated in one batch
+    int batch_min;               // --batch bounds of the handoff batch size
+    int batch_max;
+    int prefetch_window;         // --prefetch: files read ahead of the one being parsed, 0 = off
+    bool prefetch_thread;        // --prefetch-thread: an idle priority thread reads them instead of fadvise
+    bool cold_cache;             // --cold-cache: drop the data files from the page cache before the run
+    ScheduleMode schedule;       // --schedule steal|ring, watch mode always streams through the ring
+} AnalyzerOptions;
+
+// What one consumer saw of the handoff, smoothed, see adapt_batch_size
+typedef struct {
+    double fill;        // ring occupancy when taking a batch, 0..1
+    double row_ns;      // service time per row
+    unsigned long batches;
+} HandoffController;
+
+/*
+    Aggregation state of one sport. It lives in its own arena, so a sport can be reset or
+    handed to the query server on its own, and several sports can be loaded at the same time
+*/
+typedef struct {
+    Player* players; // NULL while the sport is not loaded, its rows are dropped then
+    int player_capacity;
+    int player_count;
+    int* player_index; // player_id -> index in players + 1 (0 = empty slot)
+    unsigned int player_index_mask;
+    Arena arena; // everything above that belongs to the sport
+    RankingLog ranking_log; // every counted ranking row, chunks live in arena
+    DateIndex date_index;   // per month prefix sums built from ranking_log when the batch ends
+    size_t arena_bytes[MEM_SUBSYSTEM_COUNT]; // accounted bytes of arena per subsystem
+    Player player_with_max_points;
+    pthread_mutex_t mutex; // held by a worker while it adds a row to the sport
+} SportState;
+
+struct QueryServer;
+
 typedef struct {
     BufferEntry* entries;
     int size;
     int in;
     int out;
     int count;
-    char filename[1024];
-    Player *players;
-    Player player_with_max_points_tennis;
-    Player player_with_max_points_football;
+    int batch_size; // rows per handoff, producers stage this many before taking the lock, consumers take as many
+    SportState sports[SPORT_COUNT];
+    TaskScheduler scheduler; // chunk tasks of the steal schedule, the worker clocks of both schedules
     ProfilerData profiler;
-    int player_count;
-
-    int debug_count;
+    AnalyzerOptions options;
+    struct QueryServer* query_server; // finished phases are handed over to it instead of being reset
 
     pthread_mutex_t mutex;
     pthread_cond_t not_full;
@@ -52,27 +126,62 @@ typedef struct {
     pthread_cond_t done_reading;
 
     ProcessingPhase current_phase;
+    int phase_generation; // bumped for every new batch, consumers wait on it
     bool phase_data_processed;
     pthread_mutex_t phase_mutex;
     pthread_cond_t phase_change;
 
     bool all_data_processed;
     int active_consumers;
+    int num_consumers; // active_consumers is re-armed to this at every phase change
     pthread_mutex_t completion_mutex;
     pthread_cond_t all_done;
 } SharedBuffer;
 
-typedef void (*ReportCallback)(SharedBuffer*, FILE*, bool);
+typedef void (*ReportCallback)(SharedBuffer*, const SportState*, FILE*);
 
 typedef struct {
     SharedBuffer* buffer;
     ReportCallback callback;
     FILE* file;
-    bool is_football; 
+    int sport;
 } ReportContext;
 
+/*
+    PPA of one side of a match, points / serve_points rounded to the nearest fixed point step
+    with integer arithmetic only. Adding integers is associative, so a player's PPA sum is the
+    same bit for bit whatever the order the workers add the matches in
+*/
+static inline long long ppa_fixed(int points, int serve_points) {
+    long long scaled = (long long)points * PPA_FIXED_ONE;
+    long long divisor = serve_points < 0 ? -(long long)serve_points : serve_points;
+    if (serve_points < 0) {
+        scaled = -scaled;
+    }
+    return scaled >= 0 ? (scaled + divisor / 2) / divisor : -((-scaled + divisor / 2) / divisor);
+}
+
+static inline double ppa_value(long long fixed) {
+    return (double)fixed / PPA_FIXED_ONE;
+}
+
+void init_options(AnalyzerOptions* options);
+const char* phase_name(ProcessingPhase phase);
 void init_buffer(SharedBuffer* buffer, int size);
+void init_handoff(SharedBuffer* buffer);
+void adapt_batch_size(SharedBuffer* buffer, HandoffController* controller, int occupancy, int rows, long long service_ns);
 void destroy_buffer(SharedBuffer* buffer);
-void print_top_ppa_players(SharedBuffer* buffer, FILE* file, bool is_football);
+void print_top_ppa_players(SharedBuffer* buffer, const SportState* state, FILE* file);
+
+int count_csv_rows(const char* file_path);
+int prepare_sport_state(SharedBuffer* buffer, SportState* state, int player_rows);
+void reset_sport_state(SharedBuffer* buffer, SportState* state);
+void add_player_from_csv_line(SharedBuffer* buffer, SportState* state, char* line);
+int lookup_player_id(const int* player_index, unsigned int mask, const Player* players, int id);
+int find_player_by_id(const SportState* state, int id);
+Player* find_player_with_max_points(const SportState* state);
+bool player_add_tourney(SharedBuffer* buffer, SportState* state, Player* player, int tourney);
+void record_ranking_row(SharedBuffer* buffer, SportState* state, int player, int date, int points, bool new_tourney);
+void rebuild_date_index(SharedBuffer* buffer, SportState* state);
 
 #endif // UTILS_H
\ No newline at end of file
@@ -0,0 +1,12 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "utils.h"
+
+#define WATCH_QUIET_MS 250      // a batch is closed after this long without new files
+#define WATCH_MAX_BATCH 64      // or once it holds this many files
+#define WATCH_MAX_DIRS 256
+
+void run_watch_mode(SharedBuffer* buffer, ProcessingPhase phase);
+
+#endif // WATCH_H
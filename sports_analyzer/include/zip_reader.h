@@ -0,0 +1,40 @@
+#ifndef ZIP_READER_H
+#define ZIP_READER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ZIP_MAX_NAME 256
+#define ZIP_MAX_LINE 1024        // same as a BufferEntry row, longer lines are cut
+#define ZIP_INPUT_CHUNK (64 * 1024)
+#define ZIP_OUTPUT_CHUNK (256 * 1024)
+
+typedef struct {
+    char name[ZIP_MAX_NAME];     // path inside the archive
+    uint16_t method;             // 0 stored, 8 deflate
+    uint32_t compressed_size;
+    uint32_t uncompressed_size;
+    uint32_t local_offset;       // of the local file header
+} ZipMember;
+
+/*
+    An open archive. Members are read with pread(), so any number of threads can
+    stream different members of the same archive at the same time
+*/
+typedef struct {
+    int fd;
+    ZipMember* members;
+    int member_count;
+} ZipArchive;
+
+// Called for every line of a member (newline and \r removed), return false to stop
+typedef bool (*ZipLineCallback)(const char* line, void* context);
+
+int zip_open(ZipArchive* archive, const char* path);
+void zip_close(ZipArchive* archive);
+int zip_find_member(const ZipArchive* archive, const char* base_name);
+long zip_read_member(const ZipArchive* archive, const ZipMember* member, ZipLineCallback callback, void* context);
+char* zip_extract_member(const ZipArchive* archive, const ZipMember* member, size_t* size);
+
+#endif // ZIP_READER_H
@@ -1,8 +1,14 @@
-gcc -Wall -I../include -o p main.c ../src/utils.c ../src/profiling.c
+#!/bin/bash
+
+# The serial version is the same engine with a single consumer worker
+cd "$(dirname "$0")/.." || exit 1
+
+make clean
+make
 
 if [ $? -eq 0 ]; then
     echo "Build successful"
-    ./p
+    ./sports_analyzer --threads 1
 else
     echo "Build failed"
-fi
\ No newline at end of file
+fi
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "../include/arena.h"
+
+static size_t round_up(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+/*
+    Maps a new block. Large blocks first try explicit huge pages (MAP_HUGETLB), which only
+    works if the admin reserved some, then fall back to normal pages with a transparent
+    huge page hint. Anonymous memory comes back zeroed, so arena allocations never memset.
+*/
+static ArenaBlock* map_block(size_t size) {
+    ArenaBlock* block = malloc(sizeof(ArenaBlock));
+    if (block == NULL) {
+        return NULL;
+    }
+
+    void* base = MAP_FAILED;
+    bool hugetlb = false;
+
+    if (size >= ARENA_HUGE_PAGE_SIZE) {
+        size = round_up(size, ARENA_HUGE_PAGE_SIZE);
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        hugetlb = base != MAP_FAILED;
+    }
+
+    if (base == MAP_FAILED) {
+        size = round_up(size, (size_t)sysconf(_SC_PAGESIZE));
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) {
+            free(block);
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        if (size >= ARENA_HUGE_PAGE_SIZE) {
+            madvise(base, size, MADV_HUGEPAGE);
+        }
+#endif
+    }
+
+    block->next = NULL;
+    block->base = base;
+    block->size = size;
+    block->used = 0;
+    block->hugetlb = hugetlb;
+    return block;
+}
+
+static void unmap_block(ArenaBlock* block) {
+    munmap(block->base, block->size);
+    free(block);
+}
+
+int arena_init(Arena* arena, size_t capacity) {
+    if (capacity < ARENA_MIN_BLOCK) {
+        capacity = ARENA_MIN_BLOCK;
+    }
+
+    arena->first = map_block(capacity);
+    arena->head = arena->first;
+    arena->capacity = capacity;
+    arena->allocated = 0;
+
+    if (arena->first == NULL) {
+        perror("arena mmap() error");
+        return 0;
+    }
+    return 1;
+}
+
+/*
+    Bump allocation; the returned memory is zeroed and ARENA_ALIGNMENT aligned.
+    When the current block is full a new one is chained, nothing is ever copied.
+*/
+void* arena_alloc(Arena* arena, size_t size) {
+    size = round_up(size, ARENA_ALIGNMENT);
+
+    ArenaBlock* block = arena->head;
+    if (block == NULL || block->used + size > block->size) {
+        size_t block_size = arena->capacity / 4;
+        if (block_size < ARENA_MIN_BLOCK) {
+            block_size = ARENA_MIN_BLOCK;
+        }
+        if (block_size < size) {
+            block_size = size;
+        }
+
+        ArenaBlock* next = map_block(block_size);
+        if (next == NULL) {
+            perror("arena mmap() error");
+            return NULL;
+        }
+        if (block == NULL) {
+            arena->first = next;
+        } else {
+            block->next = next;
+        }
+        arena->head = next;
+        block = next;
+    }
+
+    void* ptr = block->base + block->used;
+    block->used += size;
+    arena->allocated += size;
+    return ptr;
+}
+
+char* arena_strdup(Arena* arena, const char* str) {
+    size_t len = strlen(str) + 1;
+    char* copy = arena_alloc(arena, len);
+    if (copy != NULL) {
+        memcpy(copy, str, len);
+    }
+    return copy;
+}
+
+/*
+    Drops everything allocated so far without touching it: chained blocks are unmapped and
+    the pages of the first block are handed back to the kernel, so they read as zero again
+    the next time they are used. Cost does not depend on how many objects were allocated.
+*/
+void arena_reset(Arena* arena) {
+    if (arena->first == NULL) {
+        return;
+    }
+
+    ArenaBlock* block = arena->first->next;
+    while (block != NULL) {
+        ArenaBlock* next = block->next;
+        unmap_block(block);
+        block = next;
+    }
+    arena->first->next = NULL;
+
+    ArenaBlock* first = arena->first;
+    if (first->used > 0) {
+        if (first->hugetlb) {
+            // MADV_DONTNEED is not reliable on hugetlbfs, just map the block again
+            size_t size = first->size;
+            unmap_block(first);
+            arena->first = map_block(size);
+        } else {
+            size_t page = (size_t)sysconf(_SC_PAGESIZE);
+            madvise(first->base, round_up(first->used, page), MADV_DONTNEED);
+            first->used = 0;
+        }
+    }
+
+    arena->head = arena->first;
+    arena->allocated = 0;
+}
+
+void arena_release(Arena* arena) {
+    ArenaBlock* block = arena->first;
+    while (block != NULL) {
+        ArenaBlock* next = block->next;
+        unmap_block(block);
+        block = next;
+    }
+    arena->first = NULL;
+    arena->head = NULL;
+    arena->capacity = 0;
+    arena->allocated = 0;
+}
+
+/*
+    Makes the arena ready for a new phase that needs about `capacity` bytes.
+    The existing mapping is reused when it is big enough, otherwise it is replaced.
+*/
+int arena_prepare(Arena* arena, size_t capacity) {
+    if (arena->first != NULL && arena->capacity >= capacity) {
+        arena_reset(arena);
+        return arena->first != NULL;
+    }
+    arena_release(arena);
+    return arena_init(arena, capacity);
+}
@@ -0,0 +1,442 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "../include/async_writer.h"
+
+typedef enum {
+    RECORD_APPEND,   // add to the end of the file, buffered
+    RECORD_REPLACE,  // new content of the whole file, becomes visible atomically at the next sync
+    RECORD_SYNC,     // phase boundary: write out the buffers, fsync, publish replaced files
+    RECORD_STOP
+} RecordKind;
+
+typedef struct WriteRecord {
+    struct WriteRecord* next;
+    RecordKind kind;
+    const char* path;
+    sem_t* done;     // SYNC only, posted once the sync is on disk, NULL when nobody waits
+    size_t length;
+    char data[];
+} WriteRecord;
+
+typedef struct {
+    const char* path;
+    int fd;
+    char* buffer;    // ASYNC_WRITER_BUFFER bytes
+    size_t used;
+    bool written;    // something reached the file since the last fsync
+} AppendFile;
+
+typedef struct {
+    const char* path;
+    char tmp_path[1024];
+    int fd;
+} ReplacedFile;
+
+/*
+    Multi producer, single consumer queue (Vyukov): a producer swaps itself in as the head
+    with one atomic exchange and then links the previous head to it, the writer follows the
+    next pointers from the tail. The semaphore counts the records, the writer sleeps on it
+*/
+static struct {
+    bool running;
+    int pushers;         // producers inside enqueue, stop waits for them before it pushes STOP
+    WriteRecord* head;   // last pushed record, swapped by the producers
+    WriteRecord* tail;   // next record to take, writer only
+    WriteRecord* stub;
+    sem_t records;
+    pthread_t thread;
+
+    // Writer thread only
+    AppendFile files[ASYNC_WRITER_MAX_FILES];
+    int file_count;
+    ReplacedFile replaced[ASYNC_WRITER_MAX_FILES];
+    int replaced_count;
+    unsigned long record_count;
+    unsigned long write_calls;
+    unsigned long fsync_calls;
+    size_t bytes;
+} writer;
+
+static bool write_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        writer.write_calls++;
+        data += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+static void push_record(WriteRecord* record) {
+    __atomic_store_n(&record->next, NULL, __ATOMIC_RELAXED);
+    WriteRecord* prev = __atomic_exchange_n(&writer.head, record, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, record, __ATOMIC_RELEASE);
+}
+
+/*
+    Takes the oldest record, NULL if a producer is half way through linking it (the caller
+    knows from the semaphore that it is coming). The stub is pushed again when the queue
+    runs empty, so the last real record can be taken without racing the producers
+*/
+static WriteRecord* pop_record(void) {
+    WriteRecord* tail = writer.tail;
+    WriteRecord* next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (tail == writer.stub) {
+        if (next == NULL) {
+            return NULL;
+        }
+        writer.tail = next;
+        tail = next;
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    }
+    if (next != NULL) {
+        writer.tail = next;
+        return tail;
+    }
+    if (tail != __atomic_load_n(&writer.head, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    push_record(writer.stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next != NULL) {
+        writer.tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+static WriteRecord* new_record(RecordKind kind, const char* path, const char* data, size_t length, sem_t* done) {
+    WriteRecord* record = malloc(sizeof(WriteRecord) + length);
+    if (record == NULL) {
+        return NULL;
+    }
+    record->kind = kind;
+    record->path = path;
+    record->done = done;
+    record->length = length;
+    if (length > 0) {
+        memcpy(record->data, data, length);
+    }
+    return record;
+}
+
+/*
+    A producer announces itself in pushers before it checks running, and stop clears running
+    before it reads pushers (both sequentially consistent), so stop either sees the producer
+    and waits for its push, or the producer sees the writer stopped and writes by itself
+*/
+static bool enqueue(RecordKind kind, const char* path, const char* data, size_t length, sem_t* done) {
+    __atomic_add_fetch(&writer.pushers, 1, __ATOMIC_SEQ_CST);
+    bool pushed = false;
+    if (__atomic_load_n(&writer.running, __ATOMIC_SEQ_CST)) {
+        WriteRecord* record = new_record(kind, path, data, length, done);
+        if (record != NULL) {
+            push_record(record);
+            sem_post(&writer.records);
+            pushed = true;
+        }
+    }
+    __atomic_sub_fetch(&writer.pushers, 1, __ATOMIC_RELEASE);
+    return pushed;
+}
+
+static AppendFile* append_file(const char* path) {
+    for (int i = 0; i < writer.file_count; i++) {
+        if (strcmp(writer.files[i].path, path) == 0) {
+            return &writer.files[i];
+        }
+    }
+    if (writer.file_count == ASYNC_WRITER_MAX_FILES) {
+        return NULL;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    char* buffer = malloc(ASYNC_WRITER_BUFFER);
+    if (fd < 0 || buffer == NULL) {
+        perror("async writer open() error");
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(buffer);
+        return NULL;
+    }
+    AppendFile* file = &writer.files[writer.file_count++];
+    file->path = path;
+    file->fd = fd;
+    file->buffer = buffer;
+    file->used = 0;
+    file->written = false;
+    return file;
+}
+
+static void flush_file(AppendFile* file) {
+    if (file->used > 0) {
+        write_all(file->fd, file->buffer, file->used);
+        file->used = 0;
+        file->written = true;
+    }
+}
+
+static void handle_append(const WriteRecord* record) {
+    AppendFile* file = append_file(record->path);
+    if (file == NULL) {
+        return;
+    }
+    if (file->used + record->length > ASYNC_WRITER_BUFFER) {
+        flush_file(file);
+    }
+    if (record->length >= ASYNC_WRITER_BUFFER) {
+        write_all(file->fd, record->data, record->length);
+        file->written = true;
+    } else {
+        memcpy(file->buffer + file->used, record->data, record->length);
+        file->used += record->length;
+    }
+}
+
+/*
+    The new content goes to <path>.tmp right away, the rename over <path> waits for the sync
+    after its fsync. A file replaced twice before a sync keeps one tmp file
+*/
+static void handle_replace(const WriteRecord* record) {
+    ReplacedFile* file = NULL;
+    for (int i = 0; i < writer.replaced_count; i++) {
+        if (strcmp(writer.replaced[i].path, record->path) == 0) {
+            file = &writer.replaced[i];
+            close(file->fd);
+        }
+    }
+    if (file == NULL) {
+        if (writer.replaced_count == ASYNC_WRITER_MAX_FILES) {
+            return;
+        }
+        file = &writer.replaced[writer.replaced_count++];
+        file->path = record->path;
+        snprintf(file->tmp_path, sizeof(file->tmp_path), "%s.tmp", record->path);
+    }
+
+    file->fd = open(file->tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (file->fd < 0) {
+        printf("Error opening report file: %s\n", file->tmp_path);
+        *file = writer.replaced[--writer.replaced_count];
+        return;
+    }
+    write_all(file->fd, record->data, record->length);
+}
+
+static void parent_directory(const char* path, char* dir, size_t size) {
+    const char* slash = strrchr(path, '/');
+    if (slash == NULL) {
+        snprintf(dir, size, ".");
+    } else {
+        snprintf(dir, size, "%.*s", (int)(slash - path), path);
+    }
+}
+
+static void fsync_directory(const char* dir) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        fsync(fd);
+        writer.fsync_calls++;
+        close(fd);
+    }
+}
+
+/*
+    Phase boundary: every buffered byte goes to its file with one fsync per file that changed,
+    then the replaced files are renamed over the old ones and their directory is synced once
+*/
+static void handle_sync(void) {
+    for (int i = 0; i < writer.file_count; i++) {
+        AppendFile* file = &writer.files[i];
+        flush_file(file);
+        if (file->written) {
+            fsync(file->fd);
+            writer.fsync_calls++;
+            file->written = false;
+        }
+    }
+
+    char synced_dir[1024] = "";
+    for (int i = 0; i < writer.replaced_count; i++) {
+        ReplacedFile* file = &writer.replaced[i];
+        fsync(file->fd);
+        writer.fsync_calls++;
+        close(file->fd);
+        if (rename(file->tmp_path, file->path) != 0) {
+            perror("rename() error");
+            continue;
+        }
+        // Reports usually share a directory, it is synced once for all of them
+        char dir[1024];
+        parent_directory(file->path, dir, sizeof(dir));
+        if (strcmp(dir, synced_dir) != 0) {
+            fsync_directory(dir);
+            strcpy(synced_dir, dir);
+        }
+    }
+    writer.replaced_count = 0;
+}
+
+static void* writer_thread(void* arg) {
+    (void)arg;
+    bool stop = false;
+    while (!stop) {
+        while (sem_wait(&writer.records) != 0 && errno == EINTR) {
+        }
+        WriteRecord* record;
+        while ((record = pop_record()) == NULL) {
+            sched_yield(); // a producer is between its exchange and its link
+        }
+        writer.record_count++;
+        switch (record->kind) {
+            case RECORD_APPEND:
+                handle_append(record);
+                writer.bytes += record->length;
+                break;
+            case RECORD_REPLACE:
+                handle_replace(record);
+                writer.bytes += record->length;
+                break;
+            case RECORD_SYNC:
+                handle_sync();
+                if (record->done != NULL) {
+                    sem_post(record->done);
+                }
+                break;
+            case RECORD_STOP:
+                handle_sync();
+                stop = true;
+                break;
+        }
+        free(record);
+    }
+    return NULL;
+}
+
+void async_writer_start(void) {
+    if (writer.running) {
+        return;
+    }
+    writer.stub = calloc(1, sizeof(WriteRecord));
+    if (writer.stub == NULL) {
+        return;
+    }
+    writer.head = writer.stub;
+    writer.tail = writer.stub;
+    writer.pushers = 0;
+    writer.file_count = 0;
+    writer.replaced_count = 0;
+    writer.record_count = 0;
+    writer.write_calls = 0;
+    writer.fsync_calls = 0;
+    writer.bytes = 0;
+    sem_init(&writer.records, 0, 0);
+    __atomic_store_n(&writer.running, true, __ATOMIC_RELEASE);
+    if (pthread_create(&writer.thread, NULL, writer_thread, NULL) != 0) {
+        __atomic_store_n(&writer.running, false, __ATOMIC_RELEASE);
+        sem_destroy(&writer.records);
+        free(writer.stub);
+    }
+}
+
+void async_writer_append(const char* path, const char* data, size_t length) {
+    if (enqueue(RECORD_APPEND, path, data, length, NULL)) {
+        return;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd >= 0) {
+        write_all(fd, data, length);
+        close(fd);
+    }
+}
+
+void async_writer_replace(const char* path, const char* data, size_t length) {
+    if (enqueue(RECORD_REPLACE, path, data, length, NULL)) {
+        return;
+    }
+    // Write next to the file and rename over it, readers never see a half written file
+    char tmp_path[1024];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        printf("Error opening report file: %s\n", tmp_path);
+        return;
+    }
+    write_all(fd, data, length);
+    close(fd);
+    if (rename(tmp_path, path) != 0) {
+        perror("rename() error");
+    }
+}
+
+// Asks for a phase boundary sync, the caller does not wait for it
+void async_writer_sync(void) {
+    enqueue(RECORD_SYNC, NULL, NULL, 0, NULL);
+}
+
+/*
+    Phase boundary sync that returns once everything queued before it is on disk and the
+    replaced files are renamed over the old ones. Without the writer every write was already
+    synchronous, so there is nothing to wait for
+*/
+void async_writer_sync_wait(void) {
+    sem_t done;
+    sem_init(&done, 0, 0);
+    if (enqueue(RECORD_SYNC, NULL, NULL, 0, &done)) {
+        while (sem_wait(&done) != 0 && errno == EINTR) {
+        }
+    }
+    sem_destroy(&done);
+}
+
+/*
+    Drains the queue, syncs everything and joins the writer. New records write synchronously
+    as soon as running is cleared, the ones already being pushed are waited for, so STOP is
+    the last record of the queue. Also called from a worker aborting on the memory budget
+    while other threads still write; later calls write synchronously again
+*/
+void async_writer_stop(void) {
+    WriteRecord* stop = new_record(RECORD_STOP, NULL, NULL, 0, NULL);
+    if (stop == NULL) {
+        return;
+    }
+    bool running = true;
+    if (!__atomic_compare_exchange_n(&writer.running, &running, false, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        free(stop);
+        return;
+    }
+    while (__atomic_load_n(&writer.pushers, __ATOMIC_ACQUIRE) > 0) {
+        sched_yield();
+    }
+    push_record(stop);
+    sem_post(&writer.records);
+    pthread_join(writer.thread, NULL);
+
+    printf("Async writer: %lu records, %zu KB in %lu write calls, %lu fsyncs\n",
+           writer.record_count, writer.bytes / 1024, writer.write_calls, writer.fsync_calls);
+
+    for (int i = 0; i < writer.file_count; i++) {
+        close(writer.files[i].fd);
+        free(writer.files[i].buffer);
+    }
+    writer.file_count = 0;
+    sem_destroy(&writer.records);
+    free(writer.stub);
+    writer.stub = NULL;
+}
@@ -4,26 +4,72 @@
 #include "../include/consumer.h"
 #include "../include/utils.h"
 #include <pthread.h> 
+#include <time.h>
+
+// The batch handshake cannot go on without its locks, a failing call is a bug and stops the run
+static void check_handshake(int error, const char* call) {
+    if (error != 0) {
+        printf("Batch handshake: %s failed: %s\n", call, strerror(error));
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+    The worker is done with the current batch: it tells the producer and waits for the next
+    batch (the next phase, or the next batch of the same phase in watch mode)
+*/
+static void wait_next_batch(SharedBuffer* buffer, ProcessingPhase* current_phase, int* generation) {
+    check_handshake(pthread_mutex_lock(&buffer->completion_mutex), "pthread_mutex_lock(completion_mutex)");
+    buffer->active_consumers--;
+    if (buffer->active_consumers == 0) {
+        check_handshake(pthread_cond_signal(&buffer->all_done), "pthread_cond_signal(all_done)");
+    }
+    check_handshake(pthread_mutex_unlock(&buffer->completion_mutex), "pthread_mutex_unlock(completion_mutex)");
+
+    check_handshake(pthread_mutex_lock(&buffer->phase_mutex), "pthread_mutex_lock(phase_mutex)");
+    while (*generation == buffer->phase_generation && 
+           buffer->current_phase != PHASE_DONE) {
+        check_handshake(pthread_cond_wait(&buffer->phase_change, &buffer->phase_mutex), "pthread_cond_wait(phase_change)");
+    }
+    *current_phase = buffer->current_phase;
+    *generation = buffer->phase_generation;
+    check_handshake(pthread_mutex_unlock(&buffer->phase_mutex), "pthread_mutex_unlock(phase_mutex)");
+    // active_consumers was already re-armed by the producer
+}
 
 /*
     Consumer thread function
-    The consumer reads data from the shared buffer and processes it according to the current phase
+    The consumer reads data from the shared buffer and processes it according to the sport of each row
+    All consumers are the same kind of worker, the engine runs with any number of them (--threads)
 */
 void* consumer_thread(void* arg) {
     ConsumerArgs* args = (ConsumerArgs*)arg;
     SharedBuffer* buffer = args->buffer;
-    int consumer_id = args->consumer_id;
-    ProcessingPhase current_phase = PHASE_FOOTBALL;
+    int worker = args->consumer_id;
+    unsigned int seed = 0x9e3779b9u * (unsigned int)(worker + 1); // victims of the steals
+    sampler_thread_start("consumer");
 
-    pthread_mutex_lock(&buffer->completion_mutex);
-    buffer->active_consumers++;
-    pthread_mutex_unlock(&buffer->completion_mutex);
+    pthread_mutex_lock(&buffer->phase_mutex);
+    ProcessingPhase current_phase = buffer->current_phase;
+    int generation = buffer->phase_generation;
+    pthread_mutex_unlock(&buffer->phase_mutex);
+
+    // Rows of one batch, copied out so they are processed without holding the lock
+    BufferEntry* taken = malloc((size_t)buffer->options.batch_max * sizeof(BufferEntry));
+    HandoffController controller = { 0.0, 0.0, 0 };
 
     while (current_phase != PHASE_DONE) {
-        char data[1024];
-        char filename[1024];
-        int should_process = 0;
-        
+        if (buffer->options.schedule == SCHEDULE_STEAL) {
+            // Parse stage on the worker itself: chunks of its own deque, stolen ones when it ran empty
+            ChunkTask task;
+            while (scheduler_take(&buffer->scheduler, worker, &seed, &task)) {
+                task.run(&task, buffer);
+                scheduler_mark_busy(&buffer->scheduler, worker);
+            }
+            wait_next_batch(buffer, &current_phase, &generation);
+            continue;
+        }
+
         pthread_mutex_lock(&buffer->mutex);
         
         while (buffer->count == 0 && !buffer->phase_data_processed) {
@@ -33,79 +79,53 @@ void* consumer_thread(void* arg) {
         // Check if current phase is done
         if (buffer->count == 0 && buffer->phase_data_processed) {
             pthread_mutex_unlock(&buffer->mutex);
-            
-            // Signal phase completion
-            pthread_mutex_lock(&buffer->completion_mutex);
-            buffer->active_consumers--;
-            if (buffer->active_consumers == 0) {
-                pthread_cond_signal(&buffer->all_done);
-            }
-            pthread_mutex_unlock(&buffer->completion_mutex);
-            
-            // Wait for next phase
-            pthread_mutex_lock(&buffer->phase_mutex);
-            while (current_phase == buffer->current_phase && 
-                   buffer->current_phase != PHASE_DONE) {
-                pthread_cond_wait(&buffer->phase_change, &buffer->phase_mutex);
-            }
-            current_phase = buffer->current_phase;
-            pthread_mutex_unlock(&buffer->phase_mutex);
-            
-            if (current_phase != PHASE_DONE) {
-                pthread_mutex_lock(&buffer->completion_mutex);
-                buffer->active_consumers++;
-                pthread_mutex_unlock(&buffer->completion_mutex);
-            }
+            wait_next_batch(buffer, &current_phase, &generation);
             continue;
         }
 
-        // Check if this consumer should process this data
-        if (current_phase == PHASE_FOOTBALL) {
-            if (strstr(buffer->entries[buffer->out].filename, "data/football") != NULL) {
-                // Consumer 0 handles PPA, Consumer 1 handles max points
-                should_process = (consumer_id == 0 && strstr(buffer->entries[buffer->out].filename, "atp_rankings") == NULL) ||
-                               (consumer_id == 1 && strstr(buffer->entries[buffer->out].filename, "atp_rankings") != NULL);
+        // Every worker takes up to batch_size rows, whatever is next. A row carries its sport and
+        // whether it is a ranking or a match row. Rows of a sport that is not loaded right now are dropped
+        int occupancy = buffer->count;
+        int want = __atomic_load_n(&buffer->batch_size, __ATOMIC_RELAXED);
+        int batch = occupancy < want ? occupancy : want;
+        int kept = 0;
+        for (int i = 0; i < batch; i++) {
+            BufferEntry* entry = &buffer->entries[buffer->out];
+            if (entry->sport >= 0 && buffer->sports[entry->sport].players != NULL) {
+                strcpy(taken[kept].data, entry->data);
+                taken[kept].sport = entry->sport;
+                taken[kept].ranking = entry->ranking;
+                kept++;
             }
-        } else if (current_phase == PHASE_TENNIS) {
-            if (strstr(buffer->entries[buffer->out].filename, "data/tennis") != NULL) {
-                // Consumer 0 handles PPA, Consumer 1 handles max points
-                should_process = (consumer_id == 0 && strstr(buffer->entries[buffer->out].filename, "atp_rankings") == NULL) ||
-                               (consumer_id == 1 && strstr(buffer->entries[buffer->out].filename, "atp_rankings") != NULL);
-            }
-        }
-
-        // Copy data if this consumer should process it
-        if (should_process) {
-            strcpy(data, buffer->entries[buffer->out].data);
-            strcpy(filename, buffer->entries[buffer->out].filename);
             buffer->out = (buffer->out + 1) % buffer->size;
-            buffer->count--;
-            
-            pthread_cond_signal(&buffer->not_full);
-            pthread_mutex_unlock(&buffer->mutex);
-
-            // Process according to current phase and consumer role
-            if (current_phase == PHASE_FOOTBALL) {
-                if (consumer_id == 0) {
-                    calculate_ppa_for_football(buffer, filename, data);
-                } else {
-                    calculate_max_points_for_football(buffer, filename, data);
-                }
-            } else if (current_phase == PHASE_TENNIS) {
-                if (consumer_id == 0) {
-                    calculate_ppa_for_tennis(buffer, filename, data);
-                } else {
-                    calculate_max_points_for_tennis(buffer, filename, data);
-                }
+        }
+        buffer->count -= batch;
+
+        pthread_cond_broadcast(&buffer->not_full);
+        pthread_mutex_unlock(&buffer->mutex);
+
+        struct timespec started, finished;
+        clock_gettime(CLOCK_MONOTONIC, &started);
+        // The rows of a file come in runs of one sport and kind, each run is charged to its hotspot once
+        struct timespec run_started = started;
+        int run = 0;
+        for (int i = 0; i < kept; i++) {
+            aggregate_row(buffer, taken[i].sport, taken[i].ranking, taken[i].data);
+            if (i + 1 == kept || taken[i + 1].sport != taken[run].sport || taken[i + 1].ranking != taken[run].ranking) {
+                add_aggregation_time(buffer, taken[run].sport, taken[run].ranking, &run_started, i + 1 - run);
+                clock_gettime(CLOCK_MONOTONIC, &run_started);
+                run = i + 1;
             }
-        } else {
-            // If this consumer shouldn't process this data, just unlock and continue
-            pthread_mutex_unlock(&buffer->mutex);
         }
+        clock_gettime(CLOCK_MONOTONIC, &finished);
+        long long service_ns = (finished.tv_sec - started.tv_sec) * 1000000000LL + (finished.tv_nsec - started.tv_nsec);
+        adapt_batch_size(buffer, &controller, occupancy, batch, service_ns);
+        scheduler_mark_busy(&buffer->scheduler, worker);
     }
 
-    printf("COUNT DEBUG: %d\n", buffer->debug_count);
+    free(taken);
 
+    sampler_thread_stop();
     free(arg);
     return NULL;
 }
@@ -127,366 +147,141 @@ void* consumer_thread(void* arg) {
 
 //////////////////////////////////////////////////////////// HELPER FUNCTIONS ////////////////////////////////////////////////////////////
 
-void print_buffer_players(SharedBuffer *buffer) {
-    for (int i = 5000; i < 6000; i++) {
-        printf("Player: %s %s on index %d, PPA: %f\n", buffer->players[i].name_first, buffer->players[i].name_last, i, buffer->players[i].ppa);
-    }
-}
-
-
-int find_player_by_name(Player *players, int player_count, char* name) {
-    for (int i = 0; i < player_count; i++) {
-        char full_name[200];
-        sprintf(full_name, "%s %s", players[i].name_first, players[i].name_last);
-        if (strcmp(players[i].name_first, name) == 0) {
-            return i;
-        }
-    }
-    return -1;
-}
-
-int find_player_by_id(Player *players, int player_count, int id) {
-    for (int i = 0; i < player_count; i++) {
-        if (players[i].player_id == id) {
-            return i;
-        }
+void print_buffer_players(const SportState* state) {
+    for (int i = 5000; i < 6000 && i < state->player_count; i++) {
+        printf("Player: %s %s on index %d, PPA: %f\n", state->players[i].name_first, state->players[i].name_last, i, ppa_value(state->players[i].ppa));
     }
-    return -1;
 }
 
 
-// tourney_id,tourney_name,surface,draw_size,tourney_level,tourney_date,match_num,winner_id,winner_seed,winner_entry,
-// winner_name,winner_hand,winner_ht,winner_ioc,winner_age,loser_id,loser_seed,loser_entry,loser_name,loser_hand,loser_ht,
-// loser_ioc,loser_age,score,best_of,round,minutes,w_ace,w_df,w_svpt,w_1stIn,w_1stWon,w_2ndWon,w_SvGms,w_bpSaved,w_bpFaced,
-// l_ace,l_df,l_svpt,l_1stIn,l_1stWon,l_2ndWon,l_SvGms,l_bpSaved,l_bpFaced,winner_rank,winner_rank_points,loser_rank,loser_rank_points
+//////////////////////////////////////////////////////////// AGGREGATION KERNEL ////////////////////////////////////////////////////////////
 
 /*
-    Function to calculate the PPA for a football match
-    The PPA is calculated as the sum of aces, double faults, first serve points won and second serve points won divided 
-    by the total serve points. This is calculated for both the winner and loser of the match and the difference is added 
-    to the player's PPA.
-
-    We do the same for tennis; 
+    Reads the needed columns of a row into values[field] in one left to right scan.
+    The columns are not copied or terminated, atoi stops at the next comma anyway,
+    and the scan ends after the last column the sport needs
 */
-void calculate_ppa_for_football(SharedBuffer *buffer, char* filename, char* data) {
-    if(strstr(filename, "atp_rankings") != NULL) {
-        return;
-    }
-    start_hotspot(&buffer->profiler, "football_ppa_calculation");
-    int field_count = 0;
-    int w_ace = 0, w_df = 0, w_svpt = 0, w_1stWon = 0, w_2ndWon = 0;
-    int l_ace = 0, l_df = 0, l_svpt = 0, l_1stWon = 0, l_2ndWon = 0;
-    char winner_name[100] = {0};
-    char loser_name[100] = {0};
-    int winner_id = 0, loser_id = 0;
-
-    char* token;
-    char* rest = data;
-    char* end;
-
-    while (1) {
-        // Find the next comma or end of string
-        end = strchr(rest, ',');
-        if (end == NULL) {
-            end = rest + strlen(rest);
+static inline __attribute__((always_inline))
+void parse_row_fields(const char* data, const unsigned char* fields, int last_column, int* values) {
+    const char* p = data;
+    for (int column = 0; column <= last_column; column++) {
+        if (fields[column] != FIELD_SKIP) {
+            values[fields[column]] = atoi(p);
         }
-
-        // Create a temporary null-terminated token
-        char temp = *end;
-        *end = '\0';
-        token = rest;
-
-        // Process the token
-        switch (field_count) {
-            case 7: winner_id = atoi(token); break;
-            case 10: strncpy(winner_name, token, sizeof(winner_name) - 1); break;
-            case 15: loser_id = atoi(token); break;
-            case 18: strncpy(loser_name, token, sizeof(loser_name) - 1); break;
-            case 27: w_ace = atoi(token); break;
-            case 28: w_df = atoi(token); break;
-            case 29: w_svpt = atoi(token); break;
-            case 31: w_1stWon = atoi(token); break;
-            case 32: w_2ndWon = atoi(token); break;
-            case 33: l_ace = atoi(token); break;
-            case 34: l_df = atoi(token); break;
-            case 35: l_svpt = atoi(token); break;
-            case 37: l_1stWon = atoi(token); break;
-            case 38: l_2ndWon = atoi(token); break;
-        }
-
-        field_count++;
-
-        // Restore the original character and move to the next field
-        *end = temp;
-        if (*end == '\0') {
+        p = strchr(p, ',');
+        if (p == NULL) {
             break;
         }
-        rest = end + 1;
-    }
-
-    // Remove trailing newline characters from names
-    winner_name[strcspn(winner_name, "\r\n")] = 0;
-    loser_name[strcspn(loser_name, "\r\n")] = 0;
-
-    if(w_svpt == 0 || l_svpt == 0) {
-        return;
+        p++;
     }
-
-    //printf("Winner: %s, Loser: %s - w_ace: %d, w_df: %d, w_svpt: %d, w_1stWon: %d, w_2ndWon: %d, l_ace: %d, l_df: %d, l_svpt: %d, l_1stWon: %d, l_2ndWon: %d\n", winner_name, loser_name, w_ace, w_df, w_svpt, w_1stWon, w_2ndWon, l_ace, l_df, l_svpt, l_1stWon, l_2ndWon);
-
-    double wPPA = (double)(w_ace + w_df + w_1stWon + w_2ndWon) / w_svpt;
-    double lPPA = (double)(l_ace + l_df + l_1stWon + l_2ndWon) / l_svpt;
-
-    pthread_mutex_lock(&buffer->mutex);
-
-    int find_winner = find_player_by_id(buffer->players, buffer->player_count, winner_id);
-    int find_loser = find_player_by_id(buffer->players, buffer->player_count, loser_id);
-
-    if (find_winner != -1 && find_loser != -1) {
-        buffer->players[find_winner].ppa += wPPA;
-        buffer->players[find_loser].ppa += lPPA;
-
-        //printf("Max ppa for football: %f\n", buffer->players[find_winner].ppa);
-        //printf("OMG PLAYER FOUND IN BUFFER\n");
-    } else {
-        printf("Warning: Player not found. Winner: %s, Loser: %s\n", winner_name, loser_name);
-    }
-
-    pthread_mutex_unlock(&buffer->mutex);
-
-    // can use fprintf to write the ppa for each player to a file
-    end_hotspot(&buffer->profiler, "football_ppa_calculation");
 }
 
-void calculate_ppa_for_tennis(SharedBuffer *buffer, char* filename, char* data) {
-
-    if(strstr(filename, "atp_rankings") != NULL) {
-        return;
-    }
-    start_hotspot(&buffer->profiler, "tennis_ppa_calculation");
-    int field_count = 0;
-    int w_ace = 0, w_df = 0, w_svpt = 0, w_1stWon = 0, w_2ndWon = 0;
-    int l_ace = 0, l_df = 0, l_svpt = 0, l_1stWon = 0, l_2ndWon = 0;
-    char winner_name[100] = {0};
-    char loser_name[100] = {0};
-    int winner_id = 0, loser_id = 0;
-
-    char* token;
-    char* rest = data;
-    char* end;
-
-    while (1) {
-        // Find the next comma or end of string
-        end = strchr(rest, ',');
-        if (end == NULL) {
-            end = rest + strlen(rest);
-        }
-
-        // Create a temporary null-terminated token
-        char temp = *end;
-        *end = '\0';
-        token = rest;
-
-        // Process the token
-        switch (field_count) {
-            case 7: winner_id = atoi(token); break;
-            case 10: strncpy(winner_name, token, sizeof(winner_name) - 1); break;
-            case 15: loser_id = atoi(token); break;
-            case 18: strncpy(loser_name, token, sizeof(loser_name) - 1); break;
-            case 27: w_ace = atoi(token); break;
-            case 28: w_df = atoi(token); break;
-            case 29: w_svpt = atoi(token); break;
-            case 31: w_1stWon = atoi(token); break;
-            case 32: w_2ndWon = atoi(token); break;
-            case 33: l_ace = atoi(token); break;
-            case 34: l_df = atoi(token); break;
-            case 35: l_svpt = atoi(token); break;
-            case 37: l_1stWon = atoi(token); break;
-            case 38: l_2ndWon = atoi(token); break;
-        }
-
-        field_count++;
-
-        // Restore the original character and move to the next field
-        *end = temp;
-        if (*end == '\0') {
-            break;
-        }
-        rest = end + 1;
-    }
-
-    // Remove trailing newline characters from names
-    winner_name[strcspn(winner_name, "\r\n")] = 0;
-    loser_name[strcspn(loser_name, "\r\n")] = 0;
-
-    //printf("Winner: %s, Loser: %s, File_name %s, data %s", winner_name, loser_name, filename, data);
+/*
+    PPA of a match row
+    The PPA of each side is (aces +/- double faults + first serve points won + second serve points won)
+    divided by the serve points. The sport decides the sign of the double faults and whether a player
+    is credited with their own PPA or with the difference to the opponent. Rows without serve points
+    are skipped
+*/
+static inline __attribute__((always_inline))
+void aggregate_match(SportState* state, const SportDescriptor* sport, const char* data) {
+    int v[FIELD_COUNT] = {0};
+    parse_row_fields(data, sport->match_fields, sport->match_last_column, v);
 
-    if(w_svpt == 0 || l_svpt == 0) {
+    if (v[FIELD_W_SVPT] == 0 || v[FIELD_L_SVPT] == 0) {
         return;
     }
 
-    double wPPA = (double)(w_ace - w_df + w_1stWon + w_2ndWon) / w_svpt;
-    double lPPA = (double)(l_ace - l_df + l_1stWon + l_2ndWon) / l_svpt;
+    // Fixed point, so the sums do not depend on the order the workers take the rows in
+    long long wPPA = ppa_fixed(v[FIELD_W_ACE] + sport->df_sign * v[FIELD_W_DF] + v[FIELD_W_1ST_WON] + v[FIELD_W_2ND_WON], v[FIELD_W_SVPT]);
+    long long lPPA = ppa_fixed(v[FIELD_L_ACE] + sport->df_sign * v[FIELD_L_DF] + v[FIELD_L_1ST_WON] + v[FIELD_L_2ND_WON], v[FIELD_L_SVPT]);
+    long long winner_credit = sport->credit == PPA_DIFFERENTIAL ? wPPA - lPPA : wPPA;
+    long long loser_credit = sport->credit == PPA_DIFFERENTIAL ? lPPA - wPPA : lPPA;
 
-    pthread_mutex_lock(&buffer->mutex);
+    pthread_mutex_lock(&state->mutex);
 
-    int find_winner = find_player_by_id(buffer->players, buffer->player_count, winner_id);
-    int find_loser = find_player_by_id(buffer->players, buffer->player_count, loser_id);
+    int find_winner = find_player_by_id(state, v[FIELD_WINNER_ID]);
+    int find_loser = find_player_by_id(state, v[FIELD_LOSER_ID]);
 
     if (find_winner != -1 && find_loser != -1) {
-        buffer->players[find_winner].ppa += wPPA - lPPA;
-        buffer->players[find_loser].ppa += lPPA - wPPA;
-        //printf("OMG PLAYER FOUND IN BUFFER\n");
-        //printf("PPA: %f\n", buffer->players[find_winner].ppa);
+        state->players[find_winner].ppa += winner_credit;
+        state->players[find_loser].ppa += loser_credit;
     } else {
-        printf("Warning: Player not found. Winner: %s, Loser: %s\n", winner_name, loser_name);
+        printf("Warning: %s player not found. Winner ID: %d, Loser ID: %d\n",
+               sport->name, v[FIELD_WINNER_ID], v[FIELD_LOSER_ID]);
     }
 
-    pthread_mutex_unlock(&buffer->mutex);
-
-    end_hotspot(&buffer->profiler, "tennis_ppa_calculation");
-}
-
-void calculate_ppa_for_basket()
-{
-    //TODO
+    pthread_mutex_unlock(&state->mutex);
 }
 
 /*
-    Function to calculate the max points for a football player
-    The max points are calculated as the total points divided by the number of tournaments played
-
-    The average points per tournament are calculated for each player and compared to find the player 
-    with the highest average
+    Points of a ranking row
+    The max points are calculated as the total points divided by the number of tournaments played.
+    Here we only accumulate the points and tournaments of each player, the player with the highest
+    average is found after all rows are in (the rows of a file can arrive in any order)
 */
-void calculate_max_points_for_football(SharedBuffer *buffer, char *filename, char *data)
-{
-    if(strstr(filename, "atp_rankings") == NULL) {
-        return;
-    }
-
-    start_hotspot(&buffer->profiler, "football_points_calculation");
-
-    char *p = strtok(data, ",");
-    int i = 0;
-    int p_id = 0;
-    int p_points = 0;
-    char tourney_id[11];  // Added to store tournament ID
-    while(p)
-    {
-        switch(i)
-        {
-            case 0: strncpy(tourney_id, p, sizeof(tourney_id) - 1); tourney_id[sizeof(tourney_id)-1] = '\0'; break;
-            case 2: p_id = atoi(p); break;
-            case 3: p_points = atoi(p); break;
-        }
-        p = strtok(NULL, ",");
-        i++;
-    }
-
-    pthread_mutex_lock(&buffer->mutex);
-    buffer->debug_count++;
-    int find_player = find_player_by_id(buffer->players, buffer->player_count, p_id);
+static inline __attribute__((always_inline))
+void aggregate_ranking(SharedBuffer* buffer, SportState* state, const SportDescriptor* sport, const char* data) {
+    int v[FIELD_COUNT] = {0};
+    parse_row_fields(data, sport->ranking_fields, sport->ranking_last_column, v);
+    int tourney_id = v[FIELD_RANKING_DATE]; // ranking date (YYYYMMDD), used as tournament ID
+    int p_id = v[FIELD_RANKING_PLAYER];
+    int p_points = v[FIELD_RANKING_POINTS];
+
+    pthread_mutex_lock(&state->mutex);
+    int find_player = find_player_by_id(state, p_id);
     if (find_player != -1) {
-        // Check if tournament is already counted for this player
-        bool tourney_exists = false;
-        for (int t = 0; t < buffer->players[find_player].tourneyz_count; t++) {
-            if (strcmp(buffer->players[find_player].tourneyz[t], tourney_id) == 0) {
-                tourney_exists = true;
-                break;
-            }
-        }
-        
-        // Add new tournament if not exists
-        if (!tourney_exists) {
-            strcpy(buffer->players[find_player].tourneyz[buffer->players[find_player].tourneyz_count], tourney_id);
-            buffer->players[find_player].tourneyz_count++;
-        }
+        // Count the tournament once per player
+        bool new_tourney = player_add_tourney(buffer, state, &state->players[find_player], tourney_id);
+        record_ranking_row(buffer, state, find_player, tourney_id, p_points, new_tourney);
 
-        buffer->players[find_player].points += p_points;
-        
-        // Calculate average points per tournament
-        double avg_points = (double)buffer->players[find_player].points / 
-                          buffer->players[find_player].tourneyz_count;
-        
-        // Compare using average points
-        if (avg_points > ((double)buffer->player_with_max_points_football.points / 
-                         (buffer->player_with_max_points_football.tourneyz_count > 0 ? 
-                          buffer->player_with_max_points_football.tourneyz_count : 1))) {
-            buffer->player_with_max_points_football = buffer->players[find_player];
-        }
+        state->players[find_player].points += p_points;
+        // The player with the best average is picked once at report time, see find_player_with_max_points
     } else {
-        printf("Warning: Player not found when calc max points for football. Player ID: %d\n", p_id);
+        printf("Warning: Player not found when calc max points for %s. Player ID: %d\n", sport->name, p_id);
     }
-    pthread_mutex_unlock(&buffer->mutex);
-
-    end_hotspot(&buffer->profiler, "football_points_calculation");
+    pthread_mutex_unlock(&state->mutex);
 }
 
-void calculate_max_points_for_tennis(SharedBuffer *buffer, char *filename, char *data)
-{
-    if(strstr(filename, "atp_rankings") == NULL) {
-        return;
-    }
-
-    start_hotspot(&buffer->profiler, "tennis_points_calculation");
-
-    char *p = strtok(data, ",");
-    int i = 0;
-    int p_id = 0;
-    int p_points = 0;
-    char tourney_id[11];  // Added to store tournament ID
-    while(p)
-    {
-        switch(i)
-        {
-            case 0: strncpy(tourney_id, p, sizeof(tourney_id) - 1); tourney_id[sizeof(tourney_id)-1] = '\0'; break;
-            case 2: p_id = atoi(p); break;
-            case 3: p_points = atoi(p); break;
-        }
-        p = strtok(NULL, ",");
-        i++;
-    }
-
-    pthread_mutex_lock(&buffer->mutex);
-    int find_player = find_player_by_id(buffer->players, buffer->player_count, p_id);
-    if (find_player != -1) {
-        // Check if tournament is already counted for this player
-        bool tourney_exists = false;
-        for (int t = 0; t < buffer->players[find_player].tourneyz_count; t++) {
-            if (strcmp(buffer->players[find_player].tourneyz[t], tourney_id) == 0) {
-                tourney_exists = true;
-                break;
+/*
+    Runs one row through the kernel of its sport. Every case passes a constant descriptor,
+    so each sport gets its own copy of the kernel with the columns and the PPA variant folded in
+*/
+void aggregate_row(SharedBuffer* buffer, int sport, bool ranking, const char* data) {
+    SportState* state = &buffer->sports[sport];
+    switch (sport) {
+        case SPORT_FOOTBALL:
+            if (ranking) {
+                aggregate_ranking(buffer, state, &sport_descriptors[SPORT_FOOTBALL], data);
+            } else {
+                aggregate_match(state, &sport_descriptors[SPORT_FOOTBALL], data);
             }
-        }
-        
-        // Add new tournament if not exists
-        if (!tourney_exists) {
-            strcpy(buffer->players[find_player].tourneyz[buffer->players[find_player].tourneyz_count], tourney_id);
-            buffer->players[find_player].tourneyz_count++;
-        }
-
-        buffer->players[find_player].points += p_points;
-        
-        // Calculate average points per tournament
-        double avg_points = (double)buffer->players[find_player].points / 
-                          buffer->players[find_player].tourneyz_count;
-        
-        // Compare using average points
-        if (avg_points > ((double)buffer->player_with_max_points_tennis.points / 
-                         (buffer->player_with_max_points_tennis.tourneyz_count > 0 ? 
-                          buffer->player_with_max_points_tennis.tourneyz_count : 1))) {
-            buffer->player_with_max_points_tennis = buffer->players[find_player];
-        }
-    } else {
-        printf("Warning: Player not found when calc max points for tennis. Player ID: %d\n", p_id);
+            break;
+        case SPORT_TENNIS:
+            if (ranking) {
+                aggregate_ranking(buffer, state, &sport_descriptors[SPORT_TENNIS], data);
+            } else {
+                aggregate_match(state, &sport_descriptors[SPORT_TENNIS], data);
+            }
+            break;
+        case SPORT_BASKETBALL:
+            if (ranking) {
+                aggregate_ranking(buffer, state, &sport_descriptors[SPORT_BASKETBALL], data);
+            } else {
+                aggregate_match(state, &sport_descriptors[SPORT_BASKETBALL], data);
+            }
+            break;
     }
-    pthread_mutex_unlock(&buffer->mutex);
-
-    end_hotspot(&buffer->profiler, "tennis_points_calculation");
 }
 
-
-
-//////////////////////////////////////////////////////////// HELPER FUNCTIONS ////////////////////////////////////////////////////////////
-
+/*
+    Charges `rows` rows of one sport and kind, aggregated since `started`, to the hotspot of
+    their kernel. Callers time a whole batch or chunk, so the profiler lock is not taken per row
+*/
+void add_aggregation_time(SharedBuffer* buffer, int sport, bool ranking, const struct timespec* started, long rows) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - started->tv_sec) + (now.tv_nsec - started->tv_nsec) / 1000000000.0;
+    const SportDescriptor* descriptor = &sport_descriptors[sport];
+    add_hotspot_time(&buffer->profiler, ranking ? descriptor->points_hotspot : descriptor->ppa_hotspot, elapsed, (int)rows);
+}
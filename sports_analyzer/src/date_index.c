@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "../include/date_index.h"
+#include "../include/profiling.h"
+
+typedef struct {
+    int thread_id;
+    int thread_count;
+    RankingLogChunk** chunks;
+    int chunk_count;
+    int player_count;
+    int* counts;                // this thread's per player record count, turned into write positions
+    RankingRecord* sorted;      // records grouped by player
+    const int* offsets;
+    DateIndex* index;
+    void* (*round)(void*);
+} DateIndexTask;
+
+int date_to_month(int date) {
+    int year = date / 10000;
+    int month = date / 100 % 100;
+    if (month < 1 || month > 12) {
+        month = 1;
+    }
+    return year * 12 + month - 1;
+}
+
+bool ranking_log_needs_chunk(const RankingLog* log) {
+    return log->tail == NULL || log->tail->count == RANKING_LOG_CHUNK;
+}
+
+// Chunks are zeroed memory from the phase arena, the log is dropped together with the phase
+void ranking_log_add_chunk(RankingLog* log, RankingLogChunk* chunk) {
+    if (log->tail == NULL) {
+        log->head = chunk;
+    } else {
+        log->tail->next = chunk;
+    }
+    log->tail = chunk;
+}
+
+/*
+    Appends a ranking row to the log, the caller made sure the tail chunk has room
+    (ranking_log_needs_chunk) and serializes appends
+*/
+void ranking_log_append(RankingLog* log, int player, int date, int points, bool new_tourney) {
+    RankingRecord* record = &log->tail->records[log->tail->count++];
+    record->player = player;
+    record->month = date_to_month(date);
+    record->points = points;
+    record->new_tourney = new_tourney;
+    log->count++;
+}
+
+/*
+    Bytes of a date index built from this log, and of the temporaries needed to build it
+*/
+void date_index_sizes(const RankingLog* log, int player_count, size_t* index_bytes, size_t* build_bytes) {
+    long chunk_count = (log->count + RANKING_LOG_CHUNK - 1) / RANKING_LOG_CHUNK;
+    *index_bytes = 2 * (player_count + 1) * sizeof(int) + (log->count + 1) * sizeof(MonthPartition);
+    *build_bytes = (chunk_count + 1) * sizeof(RankingLogChunk*) + (player_count + 1) * sizeof(int)
+                 + ((size_t)DATE_INDEX_THREADS * player_count + 1) * sizeof(int)
+                 + (log->count + 1) * sizeof(RankingRecord);
+}
+
+// Round 1: every thread counts the records per player in its share of the chunks
+static void* count_records(void* arg) {
+    DateIndexTask* task = (DateIndexTask*)arg;
+    for (int c = task->thread_id; c < task->chunk_count; c += task->thread_count) {
+        RankingLogChunk* chunk = task->chunks[c];
+        for (int i = 0; i < chunk->count; i++) {
+            task->counts[chunk->records[i].player]++;
+        }
+    }
+    return NULL;
+}
+
+// Round 2: same share of chunks, records are scattered to the positions computed from the counts
+static void* scatter_records(void* arg) {
+    DateIndexTask* task = (DateIndexTask*)arg;
+    for (int c = task->thread_id; c < task->chunk_count; c += task->thread_count) {
+        RankingLogChunk* chunk = task->chunks[c];
+        for (int i = 0; i < chunk->count; i++) {
+            task->sorted[task->counts[chunk->records[i].player]++] = chunk->records[i];
+        }
+    }
+    return NULL;
+}
+
+static int compare_month(const void* a, const void* b) {
+    const RankingRecord* x = a;
+    const RankingRecord* y = b;
+    return (x->month > y->month) - (x->month < y->month);
+}
+
+// Round 3: every thread owns a contiguous range of players and builds their month partitions
+static void* build_partitions(void* arg) {
+    DateIndexTask* task = (DateIndexTask*)arg;
+    DateIndex* index = task->index;
+    int first = (long)task->player_count * task->thread_id / task->thread_count;
+    int last = (long)task->player_count * (task->thread_id + 1) / task->thread_count;
+
+    for (int p = first; p < last; p++) {
+        RankingRecord* records = task->sorted + task->offsets[p];
+        int n = task->offsets[p + 1] - task->offsets[p];
+        qsort(records, n, sizeof(RankingRecord), compare_month);
+
+        MonthPartition* out = index->partitions + task->offsets[p];
+        int count = 0;
+        long long points = 0;
+        int tourneys = 0;
+        for (int i = 0; i < n; i++) {
+            points += records[i].points;
+            tourneys += records[i].new_tourney;
+            if (count > 0 && out[count - 1].month == records[i].month) {
+                out[count - 1].points = points;
+                out[count - 1].tourneys = tourneys;
+            } else {
+                out[count].month = records[i].month;
+                out[count].points = points;
+                out[count].tourneys = tourneys;
+                count++;
+            }
+        }
+        index->offsets[p] = task->offsets[p];
+        index->counts[p] = count;
+    }
+    return NULL;
+}
+
+static void* date_index_thread(void* arg) {
+    DateIndexTask* task = (DateIndexTask*)arg;
+    sampler_thread_start("date_index");
+    task->round(task);
+    sampler_thread_stop();
+    return NULL;
+}
+
+static void run_round(DateIndexTask* tasks, int thread_count, void* (*round)(void*)) {
+    pthread_t threads[DATE_INDEX_THREADS];
+    for (int t = 1; t < thread_count; t++) {
+        tasks[t].round = round;
+        pthread_create(&threads[t], NULL, date_index_thread, &tasks[t]);
+    }
+    round(&tasks[0]);
+    for (int t = 1; t < thread_count; t++) {
+        pthread_join(threads[t], NULL);
+    }
+}
+
+/*
+    Builds the per month partitions of every player from the ranking log, in parallel:
+    a counting sort groups the records by player (count, prefix sum, scatter), then each
+    thread sorts its players' records by month and turns them into prefix sums.
+    Rebuilding is allowed, the previous index is freed first (watch mode rebuilds per batch)
+*/
+int build_date_index(DateIndex* index, const RankingLog* log, int player_count) {
+    free_date_index(index);
+
+    int chunk_count = 0;
+    for (RankingLogChunk* chunk = log->head; chunk != NULL; chunk = chunk->next) {
+        chunk_count++;
+    }
+
+    RankingLogChunk** chunks = malloc((chunk_count + 1) * sizeof(RankingLogChunk*));
+    int* offsets = calloc(player_count + 1, sizeof(int));
+    int* counts = calloc((size_t)DATE_INDEX_THREADS * player_count + 1, sizeof(int));
+    RankingRecord* sorted = malloc((log->count + 1) * sizeof(RankingRecord));
+    index->offsets = malloc((player_count + 1) * sizeof(int));
+    index->counts = calloc(player_count + 1, sizeof(int));
+    index->partitions = malloc((log->count + 1) * sizeof(MonthPartition));
+
+    if (!chunks || !offsets || !counts || !sorted || !index->offsets || !index->counts || !index->partitions) {
+        printf("Error allocating the date index\n");
+        free(chunks);
+        free(offsets);
+        free(counts);
+        free(sorted);
+        free_date_index(index);
+        return 0;
+    }
+
+    int c = 0;
+    for (RankingLogChunk* chunk = log->head; chunk != NULL; chunk = chunk->next) {
+        chunks[c++] = chunk;
+    }
+
+    int thread_count = chunk_count < DATE_INDEX_THREADS ? (chunk_count > 0 ? chunk_count : 1) : DATE_INDEX_THREADS;
+    DateIndexTask tasks[DATE_INDEX_THREADS];
+    for (int t = 0; t < thread_count; t++) {
+        tasks[t].thread_id = t;
+        tasks[t].thread_count = thread_count;
+        tasks[t].chunks = chunks;
+        tasks[t].chunk_count = chunk_count;
+        tasks[t].player_count = player_count;
+        tasks[t].counts = counts + (size_t)t * player_count;
+        tasks[t].sorted = sorted;
+        tasks[t].offsets = offsets;
+        tasks[t].index = index;
+    }
+
+    run_round(tasks, thread_count, count_records);
+
+    // Player p starts at offsets[p], inside it thread t writes after the records of threads < t
+    int position = 0;
+    for (int p = 0; p < player_count; p++) {
+        offsets[p] = position;
+        for (int t = 0; t < thread_count; t++) {
+            int n = tasks[t].counts[p];
+            tasks[t].counts[p] = position;
+            position += n;
+        }
+    }
+    offsets[player_count] = position;
+
+    run_round(tasks, thread_count, scatter_records);
+    run_round(tasks, thread_count, build_partitions);
+
+    index->player_count = player_count;
+    index->bytes = 2 * (player_count + 1) * sizeof(int) + (log->count + 1) * sizeof(MonthPartition);
+    index->built = true;
+
+    free(chunks);
+    free(offsets);
+    free(counts);
+    free(sorted);
+    return 1;
+}
+
+void free_date_index(DateIndex* index) {
+    free(index->offsets);
+    free(index->counts);
+    free(index->partitions);
+    memset(index, 0, sizeof(DateIndex));
+}
+
+// Prefix sums of the last partition with month <= month, zero when there is none
+static void prefix_at(const MonthPartition* partitions, int count, int month, long long* points, int* tourneys) {
+    int low = 0, high = count; // first partition with month > month
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (partitions[mid].month <= month) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    *points = low > 0 ? partitions[low - 1].points : 0;
+    *tourneys = low > 0 ? partitions[low - 1].tourneys : 0;
+}
+
+/*
+    Points and tournaments of a player between two dates (YYYYMMDD, both included, month
+    granularity): two binary searches and a difference of prefix sums
+*/
+bool date_index_range(const DateIndex* index, int player, int from_date, int to_date,
+                      long long* points, int* tourneys) {
+    if (!index->built || player < 0 || player >= index->player_count) {
+        return false;
+    }
+
+    const MonthPartition* partitions = index->partitions + index->offsets[player];
+    int count = index->counts[player];
+
+    long long to_points, from_points;
+    int to_tourneys, from_tourneys;
+    prefix_at(partitions, count, date_to_month(to_date), &to_points, &to_tourneys);
+    prefix_at(partitions, count, date_to_month(from_date) - 1, &from_points, &from_tourneys);
+
+    *points = to_points - from_points;
+    *tourneys = to_tourneys - from_tourneys;
+    return true;
+}
+
+/*
+    Player with the best average points per tournament between two dates, -1 if nobody played
+*/
+int date_index_best_average(const DateIndex* index, int from_date, int to_date, double* best_avg) {
+    int best = -1;
+    for (int p = 0; p < index->player_count; p++) {
+        long long points;
+        int tourneys;
+        if (date_index_range(index, p, from_date, to_date, &points, &tourneys) && tourneys > 0) {
+            double avg = (double)points / tourneys;
+            if (best == -1 || avg > *best_avg) {
+                best = p;
+                *best_avg = avg;
+            }
+        }
+    }
+    return best;
+}
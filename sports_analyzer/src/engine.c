@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "../include/engine.h"
+#include "../include/producer.h"
+#include "../include/consumer.h"
+#include "../include/profiling.h"
+#include "../include/utils.h"
+#include "../include/query_server.h"
+#include "../include/async_writer.h"
+
+/*
+    One complete run of the pipeline: one producer, options->threads consumer workers and the
+    profiler. A serial run is the same engine with a single worker. The time from starting the
+    pipeline threads until all of them finished is stored in elapsed_seconds (the profiler
+    and the query server are not part of it). Returns 0 if the run could not be started
+*/
+int run_analyzer(const AnalyzerOptions* options, double* elapsed_seconds) {
+    pthread_t producers[NUM_PRODUCERS];
+    pthread_t consumers[MAX_WORKERS];
+    pthread_t profiler_thread_id;
+    int workers = options->threads;
+
+    SharedBuffer buffer;
+    init_buffer(&buffer, BUFFER_SIZE);
+    buffer.options = *options;
+    init_profiler(&buffer.profiler);
+    init_handoff(&buffer);
+    async_writer_start();
+    buffer.profiler.memory_budget = buffer.options.memory_budget;
+    buffer.profiler.budget_policy = buffer.options.budget_policy;
+    if (buffer.options.sample_hz > 0 && !sampler_start(buffer.options.sample_hz)) {
+        printf("Sampling profiler could not be started, running without it\n");
+    }
+
+    // The ring is allocated by init_buffer, before the profiler exists
+    // In watch mode the pipeline starts directly in the phase of the watched sport,
+    // a single pass run in the one phase that covers every sport
+    if (buffer.options.watch_phase != PHASE_DONE) {
+        buffer.current_phase = buffer.options.watch_phase;
+    } else if (buffer.options.single_pass) {
+        buffer.current_phase = PHASE_ALL_SPORTS;
+    }
+    memory_phase_begin(&buffer.profiler, phase_name(buffer.current_phase));
+    memory_reserve(&buffer.profiler, MEM_RING_ENTRIES, (size_t)buffer.size * sizeof(BufferEntry), false);
+
+    // Consumers count as active from the start, otherwise a fast producer could see
+    // active_consumers == 0 before they got scheduled and skip the whole phase
+    buffer.num_consumers = workers;
+    buffer.active_consumers = workers;
+    if (!scheduler_init(&buffer.scheduler, workers)) {
+        destroy_buffer(&buffer);
+        return 0;
+    }
+
+    // The server starts before loading, each sport becomes queryable when its phase is done
+    QueryServer* server = NULL;
+    if (buffer.options.serve_path != NULL) {
+        server = malloc(sizeof(QueryServer));
+        if (!query_server_start(server, buffer.options.serve_path)) {
+            free(server);
+            scheduler_destroy(&buffer.scheduler);
+            destroy_buffer(&buffer);
+            return 0;
+        }
+        buffer.query_server = server;
+    }
+
+    pthread_create(&profiler_thread_id, NULL, profiling_thread, &buffer);
+
+    // Outside the timed part, the run then starts with none of its input cached
+    if (buffer.options.cold_cache) {
+        int files = 0;
+        size_t bytes = 0;
+        for (int i = 0; i < SPORT_COUNT; i++) {
+            bytes += drop_cached_files(sport_descriptors[i].data_dir, &files);
+        }
+        printf("Cold cache: dropped %d data files (%zu KB) from the page cache\n", files, bytes / 1024);
+    }
+
+    scheduler_open(&buffer.scheduler); // the worker clocks of the first batch start with the pipeline
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    // Create producer threads
+    for (int i = 0; i < NUM_PRODUCERS; i++) {
+        ProducerArgs* args = malloc(sizeof(ProducerArgs)); // for passing the arguments to the producer thread
+        args->buffer = &buffer;
+        args->producer_id = i;
+        pthread_create(&producers[i], NULL, producer_thread, args);
+    }
+
+    // Create consumer threads
+    for (int i = 0; i < workers; i++) {
+        ConsumerArgs* args = malloc(sizeof(ConsumerArgs)); // for passing the arguments to the consumer thread
+        args->buffer = &buffer;
+        args->consumer_id = i;
+        pthread_create(&consumers[i], NULL, consumer_thread, args);
+    }
+
+    // Wait for producers to complete
+    for (int i = 0; i < NUM_PRODUCERS; i++) {
+        pthread_join(producers[i], NULL);
+    }
+
+    // Wait for all consumers to finish
+    pthread_mutex_lock(&buffer.completion_mutex);
+    while (buffer.active_consumers > 0) {
+        pthread_cond_wait(&buffer.all_done, &buffer.completion_mutex);
+    }
+    pthread_mutex_unlock(&buffer.completion_mutex);
+
+    // Now safe to join consumer threads
+    for (int i = 0; i < workers; i++) {
+        pthread_join(consumers[i], NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    if (elapsed_seconds != NULL) {
+        *elapsed_seconds = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+    }
+
+    pthread_join(profiler_thread_id, NULL);
+    async_writer_stop(); // every thread that logs or reports is done
+
+    if (server != NULL) {
+        query_server_wait(server);
+        free(server);
+    }
+
+    // Every sampled thread is joined by now
+    sampler_write(SAMPLER_OUTPUT);
+
+    // Clean up
+    scheduler_destroy(&buffer.scheduler);
+    destroy_buffer(&buffer);
+
+    return 1;
+}
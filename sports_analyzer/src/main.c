@@ -1,63 +1,166 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <pthread.h>
-#include "../include/producer.h"
-#include "../include/consumer.h"
+#include <string.h>
+#include "../include/engine.h"
+#include "../include/sweep.h"
 #include "../include/profiling.h"
 #include "../include/utils.h"
 
-#define NUM_PRODUCERS 1
-#define NUM_CONSUMERS 2
-#define BUFFER_SIZE 1000
+static void print_usage(const char* program) {
+    printf("Usage: %s [--watch <sport> | --serve <socket>] [--single-pass] [--range <from> <to>]\n"
+           "          [--memory-budget <MB>] [--budget-policy abort|degrade] [--sample-profile [hz]]\n"
+           "          [--threads <n> | --sweep <max threads> [--repeat <runs>]] [--batch <min> <max>]\n"
+           "          [--prefetch <files>] [--prefetch-thread] [--cold-cache] [--schedule steal|ring]\n", program);
+    printf("  --watch <sport>   process data/<sport>, then keep ingesting new CSV files as they arrive\n");
+    printf("  --serve <socket>  load and aggregate once, then answer queries on a Unix socket\n");
+    printf("  --single-pass     aggregate every sport in one pass over all data directories\n");
+    printf("  --range <from> <to>  also report the best average points per tournament between two dates (YYYYMMDD)\n");
+    printf("  --memory-budget <MB> limit for the tracked memory (see performance_log.txt)\n");
+    printf("  --budget-policy <p>  abort (default) stops the run over budget, degrade skips the date and query indexes\n");
+    printf("  --sample-profile [hz] sample the stacks of every thread (default %d Hz), folded stacks go to %s\n",
+           SAMPLER_DEFAULT_HZ, SAMPLER_OUTPUT);
+    printf("  --threads <n>     number of consumer workers (default %d), --threads 1 is the serial run\n", DEFAULT_WORKERS);
+    printf("  --batch <min> <max> bounds of the rows per producer/consumer handoff (default %d %d), the size\n"
+           "                    adapts to the ring occupancy and the consumer service time in between\n",
+           HANDOFF_BATCH_MIN, HANDOFF_BATCH_MAX);
+    printf("  --prefetch <files> data files read into the page cache ahead of the one being parsed\n"
+           "                    (default %d, 0 = off)\n", PREFETCH_WINDOW);
+    printf("  --prefetch-thread read ahead on an idle priority thread instead of posix_fadvise\n");
+    printf("  --cold-cache      drop the data files from the page cache before each run, to time cold reads\n");
+    printf("  --schedule <s>    steal (default): workers parse chunks of the files themselves and steal chunks\n"
+           "                    from each other, ring: the producer parses every row into the shared ring\n");
+    printf("  --sweep <max>     run with 1, 2, 4, ... <max> workers and print speedup, efficiency and the\n");
+    printf("                    Karp-Flatt serial fraction to %s, each count is run --repeat times (default %d)\n",
+           SWEEP_OUTPUT, SWEEP_DEFAULT_REPEAT);
+}
 
-int main() {
-    pthread_t producers[NUM_PRODUCERS];
-    pthread_t consumers[NUM_CONSUMERS];
-    pthread_t profiler_thread_id;
-
-    SharedBuffer buffer;
-    init_buffer(&buffer, BUFFER_SIZE);
-    init_profiler(&buffer.profiler);
-
-    pthread_create(&profiler_thread_id, NULL, profiling_thread, &buffer);
-
-    // Create producer threads
-    for (int i = 0; i < NUM_PRODUCERS; i++) {
-        ProducerArgs* args = malloc(sizeof(ProducerArgs)); // for passing the arguments to the producer thread
-        args->buffer = &buffer;
-        args->producer_id = i;
-        pthread_create(&producers[i], NULL, producer_thread, args);
+/*
+    Parses the command line into the analyzer options, returns 0 on a bad command line
+*/
+static int parse_options(int argc, char* argv[], AnalyzerOptions* options) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc) {
+            int sport = sport_by_name(argv[++i]);
+            if (sport < 0) {
+                printf("Unknown sport for --watch: %s\n", argv[i]);
+                return 0;
+            }
+            options->watch_phase = (ProcessingPhase)sport;
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 2 < argc) {
+            options->batch_min = atoi(argv[++i]);
+            options->batch_max = atoi(argv[++i]);
+            if (options->batch_min < 1 || options->batch_max < options->batch_min ||
+                options->batch_max > HANDOFF_BATCH_LIMIT) {
+                printf("Bad batch bounds, expected 1 <= min <= max <= %d\n", HANDOFF_BATCH_LIMIT);
+                return 0;
+            }
+        } else if (strcmp(argv[i], "--prefetch") == 0 && i + 1 < argc) {
+            options->prefetch_window = atoi(argv[++i]);
+            if (options->prefetch_window < 0 || options->prefetch_window > PREFETCH_MAX_WINDOW) {
+                printf("Prefetch window must be between 0 and %d files\n", PREFETCH_MAX_WINDOW);
+                return 0;
+            }
+        } else if (strcmp(argv[i], "--prefetch-thread") == 0) {
+            options->prefetch_thread = true;
+        } else if (strcmp(argv[i], "--cold-cache") == 0) {
+            options->cold_cache = true;
+        } else if (strcmp(argv[i], "--schedule") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "steal") == 0) {
+                options->schedule = SCHEDULE_STEAL;
+            } else if (strcmp(argv[i], "ring") == 0) {
+                options->schedule = SCHEDULE_RING;
+            } else {
+                printf("Unknown schedule: %s\n", argv[i]);
+                return 0;
+            }
+        } else if (strcmp(argv[i], "--single-pass") == 0) {
+            options->single_pass = true;
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            options->serve_path = argv[++i];
+        } else if (strcmp(argv[i], "--range") == 0 && i + 2 < argc) {
+            options->range_from = atoi(argv[++i]);
+            options->range_to = atoi(argv[++i]);
+            if (options->range_from <= 0 || options->range_to < options->range_from) {
+                printf("Bad date range, expected <from> <to> as YYYYMMDD with from <= to\n");
+                return 0;
+            }
+        } else if (strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc) {
+            long megabytes = atol(argv[++i]);
+            if (megabytes <= 0) {
+                printf("Bad memory budget: %s\n", argv[i]);
+                return 0;
+            }
+            options->memory_budget = (size_t)megabytes * 1024 * 1024;
+        } else if (strcmp(argv[i], "--sample-profile") == 0) {
+            options->sample_hz = SAMPLER_DEFAULT_HZ;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                options->sample_hz = atoi(argv[++i]);
+                if (options->sample_hz <= 0) {
+                    printf("Bad sampling rate: %s\n", argv[i]);
+                    return 0;
+                }
+            }
+        } else if ((strcmp(argv[i], "--threads") == 0 || strcmp(argv[i], "--sweep") == 0) && i + 1 < argc) {
+            bool sweep = strcmp(argv[i], "--sweep") == 0;
+            int threads = atoi(argv[++i]);
+            if (threads < 1 || threads > MAX_WORKERS) {
+                printf("Thread count must be between 1 and %d\n", MAX_WORKERS);
+                return 0;
+            }
+            if (sweep) {
+                options->sweep_max = threads;
+            } else {
+                options->threads = threads;
+            }
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            options->sweep_repeat = atoi(argv[++i]);
+            if (options->sweep_repeat < 1) {
+                printf("Bad repeat count: %s\n", argv[i]);
+                return 0;
+            }
+        } else if (strcmp(argv[i], "--budget-policy") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "abort") == 0) {
+                options->budget_policy = BUDGET_ABORT;
+            } else if (strcmp(argv[i], "degrade") == 0) {
+                options->budget_policy = BUDGET_DEGRADE;
+            } else {
+                printf("Unknown budget policy: %s\n", argv[i]);
+                return 0;
+            }
+        } else {
+            return 0;
+        }
     }
-
-    // Create consumer threads
-    for (int i = 0; i < NUM_CONSUMERS; i++) {
-        ConsumerArgs* args = malloc(sizeof(ConsumerArgs)); // for passing the arguments to the consumer thread
-        args->buffer = &buffer;
-        args->consumer_id = i;
-        pthread_create(&consumers[i], NULL, consumer_thread, args);
+    if (options->watch_phase != PHASE_DONE && options->serve_path != NULL) {
+        printf("--watch and --serve cannot be combined\n");
+        return 0;
     }
-
-    // Wait for producers to complete
-    for (int i = 0; i < NUM_PRODUCERS; i++) {
-        pthread_join(producers[i], NULL);
+    if (options->watch_phase != PHASE_DONE) {
+        options->schedule = SCHEDULE_RING; // new files are streamed row by row as they are written
     }
-
-    // Wait for all consumers to finish
-    pthread_mutex_lock(&buffer.completion_mutex);
-    while (buffer.active_consumers > 0) {
-        pthread_cond_wait(&buffer.all_done, &buffer.completion_mutex);
+    if (options->watch_phase != PHASE_DONE && options->single_pass) {
+        printf("--watch follows one sport, it cannot be combined with --single-pass\n");
+        return 0;
     }
-    pthread_mutex_unlock(&buffer.completion_mutex);
-
-    // Now safe to join consumer threads
-    for (int i = 0; i < NUM_CONSUMERS; i++) {
-        pthread_join(consumers[i], NULL);
+    if (options->sweep_max > 0 && (options->watch_phase != PHASE_DONE || options->serve_path != NULL)) {
+        printf("--sweep runs the batch pipeline, it cannot be combined with --watch or --serve\n");
+        return 0;
     }
+    return 1;
+}
 
-    pthread_join(profiler_thread_id, NULL);
-
-    // Clean up
-    destroy_buffer(&buffer);
+int main(int argc, char* argv[]) {
+    AnalyzerOptions options;
+    init_options(&options);
+    if (!parse_options(argc, argv, &options)) {
+        print_usage(argv[0]);
+        return 1;
+    }
 
-    return 0;
-}
\ No newline at end of file
+    if (options.sweep_max > 0) {
+        return run_sweep(&options) ? 0 : 1;
+    }
+    return run_analyzer(&options, NULL) ? 0 : 1;
+}
@@ -0,0 +1,143 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include "../include/prefetch.h"
+
+/*
+    Starts reading one file into the page cache, returns its size (0 if it cannot be opened).
+    The advice only queues the read, readahead() blocks until the pages are requested
+*/
+static size_t prefetch_file(const char* path, bool blocking) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    size_t size = fstat(fd, &st) == 0 ? (size_t)st.st_size : 0;
+    if (blocking) {
+        readahead(fd, 0, size);
+    } else {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    }
+    close(fd);
+    return size;
+}
+
+/*
+    Idle priority: it only gets a core the pipeline threads do not use, so reading ahead
+    never takes time from parsing or aggregating
+*/
+static void* prefetch_thread(void* arg) {
+    Prefetcher* prefetcher = (Prefetcher*)arg;
+    struct sched_param param = {0};
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+
+    pthread_mutex_lock(&prefetcher->mutex);
+    while (!prefetcher->stop) {
+        if (prefetcher->next < prefetcher->count &&
+            prefetcher->next <= prefetcher->current + prefetcher->window) {
+            int file = prefetcher->next++;
+            pthread_mutex_unlock(&prefetcher->mutex);
+            size_t size = prefetch_file(prefetcher->paths[file], true);
+            pthread_mutex_lock(&prefetcher->mutex);
+            prefetcher->files++;
+            prefetcher->bytes += size;
+        } else {
+            pthread_cond_wait(&prefetcher->moved, &prefetcher->mutex);
+        }
+    }
+    pthread_mutex_unlock(&prefetcher->mutex);
+    return NULL;
+}
+
+/*
+    The producer is about to parse paths[0], so prefetching starts with the file after it.
+    A window of 0 turns prefetching off
+*/
+void prefetch_start(Prefetcher* prefetcher, const char (*paths)[PREFETCH_PATH], int count, int window, bool threaded) {
+    prefetcher->paths = paths;
+    prefetcher->count = count;
+    prefetcher->window = window;
+    prefetcher->threaded = threaded && window > 0;
+    prefetcher->current = 0;
+    prefetcher->next = 1;
+    prefetcher->stop = false;
+    prefetcher->files = 0;
+    prefetcher->bytes = 0;
+    pthread_mutex_init(&prefetcher->mutex, NULL);
+    pthread_cond_init(&prefetcher->moved, NULL);
+    if (prefetcher->threaded && pthread_create(&prefetcher->thread, NULL, prefetch_thread, prefetcher) != 0) {
+        prefetcher->threaded = false;
+    }
+    prefetch_advance(prefetcher, 0);
+}
+
+// Called before the producer opens paths[current]
+void prefetch_advance(Prefetcher* prefetcher, int current) {
+    if (prefetcher->threaded) {
+        pthread_mutex_lock(&prefetcher->mutex);
+        prefetcher->current = current;
+        pthread_cond_signal(&prefetcher->moved);
+        pthread_mutex_unlock(&prefetcher->mutex);
+        return;
+    }
+    prefetcher->current = current;
+    while (prefetcher->window > 0 && prefetcher->next < prefetcher->count && prefetcher->next <= current + prefetcher->window) {
+        prefetcher->bytes += prefetch_file(prefetcher->paths[prefetcher->next++], false);
+        prefetcher->files++;
+    }
+}
+
+void prefetch_stop(Prefetcher* prefetcher) {
+    if (prefetcher->threaded) {
+        pthread_mutex_lock(&prefetcher->mutex);
+        prefetcher->stop = true;
+        pthread_cond_signal(&prefetcher->moved);
+        pthread_mutex_unlock(&prefetcher->mutex);
+        pthread_join(prefetcher->thread, NULL);
+    }
+    pthread_mutex_destroy(&prefetcher->mutex);
+    pthread_cond_destroy(&prefetcher->moved);
+}
+
+/*
+    Cold cache runs (--cold-cache): asks the kernel to drop the cached pages of every file under
+    dir_path, the next read of them goes to the disk again. Unlike drop_caches this needs no root
+    and leaves the rest of the system alone. Returns the bytes dropped, *files counts the files
+*/
+size_t drop_cached_files(const char* dir_path, int* files) {
+    DIR* dir = opendir(dir_path);
+    if (dir == NULL) {
+        return 0;
+    }
+    size_t bytes = 0;
+    struct dirent* entry;
+    char path[PREFETCH_PATH];
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+        if (entry->d_type == DT_DIR) {
+            bytes += drop_cached_files(path, files);
+            continue;
+        }
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0) {
+            bytes += (size_t)st.st_size;
+            (*files)++;
+        }
+        close(fd);
+    }
+    closedir(dir);
+    return bytes;
+}
@@ -1,75 +1,512 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <dirent.h>
 #include <sys/stat.h>
 #include "../include/producer.h"
 #include "../include/utils.h"
+#include "../include/watch.h"
+#include "../include/query_server.h"
+#include "../include/zip_reader.h"
+#include "../include/async_writer.h"
+#include "../include/prefetch.h"
+#include "../include/consumer.h"
 
 #define MAX_PATH 1024
 
 
 /*
-    Function to process a CSV file and add its data to the shared buffer
-    The data is read line by line and added to the buffer as long the buffer is not full
-    and there are still active consumers
+    Rows staged by one reading thread. They go to the shared buffer together under one lock,
+    as soon as there are buffer->batch_size of them (the consumers adapt that size)
 */
-void process_csv_file(const char* file_path, SharedBuffer* buffer) {
+typedef struct {
+    BufferEntry* rows; // options.batch_max entries
+    int count;
+} RowBatch;
+
+static bool init_row_batch(SharedBuffer* buffer, RowBatch* batch) {
+    batch->rows = malloc((size_t)buffer->options.batch_max * sizeof(BufferEntry));
+    batch->count = 0;
+    return batch->rows != NULL;
+}
 
-    start_hotspot(&buffer->profiler, "csv_file_processing");
+/*
+    Moves the staged rows to the shared buffer, waiting while the buffer is full. When it does
+    not have room for the whole batch, the rows that fit are handed over first
+    Returns false when there are no active consumers left to take them
+*/
+static bool flush_rows(SharedBuffer* buffer, RowBatch* batch) {
+    int done = 0;
+    pthread_mutex_lock(&buffer->mutex);
+    while (done < batch->count) {
+        // Check if there are still active consumers
+        if (buffer->active_consumers == 0) {
+            pthread_mutex_unlock(&buffer->mutex);
+            batch->count = 0;
+            return false;
+        }
+        if (buffer->count == buffer->size) {
+            pthread_cond_wait(&buffer->not_full, &buffer->mutex);
+            continue;
+        }
+
+        while (done < batch->count && buffer->count < buffer->size) {
+            BufferEntry* entry = &buffer->entries[buffer->in];
+            strcpy(entry->data, batch->rows[done].data);
+            entry->sport = batch->rows[done].sport;
+            entry->ranking = batch->rows[done].ranking;
+            buffer->in = (buffer->in + 1) % buffer->size;
+            buffer->count++;
+            done++;
+        }
+        pthread_cond_broadcast(&buffer->not_empty);
+    }
+    pthread_mutex_unlock(&buffer->mutex);
+    batch->count = 0;
+    return true;
+}
+
+// Stages one row, flushes when the batch reached the current batch size
+static bool push_row(SharedBuffer* buffer, RowBatch* batch, const char* line, int sport, bool ranking) {
+    BufferEntry* row = &batch->rows[batch->count++];
+    strcpy(row->data, line);
+    row->sport = sport;
+    row->ranking = ranking;
+    if (batch->count >= __atomic_load_n(&buffer->batch_size, __ATOMIC_RELAXED)) {
+        return flush_rows(buffer, batch);
+    }
+    return true;
+}
 
+typedef bool (*CsvRowCallback)(const char* line, void* context);
+
+/*
+    Reads the rows of one byte range of a CSV file and hands each one to row, stops early when
+    row returns false. Returns the rows read, -1 if the file cannot be opened
+    A range owns every line that starts inside [start, end). A range that does not start at 0
+    skips the partial line it lands in (the previous range reads it to the end), so once the
+    ranges cover the file every row is read exactly once. Only the range at 0 skips the header
+*/
+static long read_csv_range(const char* file_path, long start, long end, CsvRowCallback row, void* context) {
     FILE* file = fopen(file_path, "r");
     if (file == NULL) {
         printf("Error opening file: %s\n", file_path);
-        return;
+        return -1;
     }
 
     char line[1024];
-    fgets(line, sizeof(line), file); // Skip header
-    while (fgets(line, sizeof(line), file)) {
-        // Remove newline character
-        line[strcspn(line, "\n")] = 0;
-        
-        // Add data to buffer
-        pthread_mutex_lock(&buffer->mutex);
-        
-        // Check if there are still active consumers
-        if (buffer->active_consumers == 0) {
-            pthread_mutex_unlock(&buffer->mutex);
-            fclose(file);
-            return;
+    long offset = start;
+    long rows = 0;
+    if (offset == 0) {
+        if (fgets(line, sizeof(line), file)) { // Skip header
+            offset += strlen(line);
         }
-        
-        while (buffer->count == buffer->size) { 
-            pthread_cond_wait(&buffer->not_full, &buffer->mutex);
-            // Check again after waking up
-            if (buffer->active_consumers == 0) {
-                pthread_mutex_unlock(&buffer->mutex);
-                fclose(file);
-                return;
+    } else {
+        // Align to the first line starting at or after start
+        fseek(file, offset - 1, SEEK_SET);
+        offset--;
+        int c;
+        while ((c = fgetc(file)) != EOF) {
+            offset++;
+            if (c == '\n') {
+                break;
             }
         }
-        
-        strcpy(buffer->entries[buffer->in].data, line);
-        strcpy(buffer->entries[buffer->in].filename, file_path);
+    }
 
-        buffer->in = (buffer->in + 1) % buffer->size;
-        buffer->count++;
-        
-        pthread_cond_signal(&buffer->not_empty);
-        pthread_mutex_unlock(&buffer->mutex);
+    while (offset < end && fgets(line, sizeof(line), file)) {
+        offset += strlen(line);
+        // Remove newline character
+        line[strcspn(line, "\n")] = 0;
+
+        if (!row(line, context)) {
+            break;
+        }
+        rows++;
     }
 
-    printf("Finished reading file: %s\n", file_path);
     fclose(file);
+    return rows;
+}
+
+typedef struct {
+    SharedBuffer* buffer;
+    RowBatch* batch;
+    int sport;
+    bool ranking;
+} RangeRows;
+
+static bool push_range_line(const char* line, void* context) {
+    RangeRows* rows = context;
+    return push_row(rows->buffer, rows->batch, line, rows->sport, rows->ranking);
+}
+
+// Parses the rows of one byte range of a CSV file into the shared buffer
+static void* parse_csv_range(void* arg) {
+    CsvRange* range = (CsvRange*)arg;
+
+    RowBatch batch;
+    if (!init_row_batch(range->buffer, &batch)) {
+        return NULL;
+    }
+
+    RangeRows rows = { range->buffer, &batch, range->sport, range->ranking };
+    long count = read_csv_range(range->file_path, range->start, range->end, push_range_line, &rows);
+    range->rows = count > 0 ? (int)count : 0;
+    flush_rows(range->buffer, &batch);
+
+    free(batch.rows);
+    return NULL;
+}
+
+// Extra range threads, range 0 is parsed on the producer thread itself
+static void* parse_range_thread(void* arg) {
+    sampler_thread_start("parse_range");
+    parse_csv_range(arg);
+    sampler_thread_stop();
+    return NULL;
+}
+
+/*
+    Function to process a CSV file and add its data to the shared buffer
+    The data is read line by line and added to the buffer as long the buffer is not full
+    and there are still active consumers
+    Files bigger than PARALLEL_PARSE_MIN_BYTES are split into PARSE_THREADS newline aligned
+    byte ranges that are parsed concurrently, the rows of all ranges go to the same consumers
+*/
+void process_csv_file(const char* file_path, SharedBuffer* buffer) {
+
+    start_hotspot(&buffer->profiler, "csv_file_processing");
+
+    struct stat st;
+    if (stat(file_path, &st) != 0) {
+        printf("Error opening file: %s\n", file_path);
+        end_hotspot(&buffer->profiler, "csv_file_processing");
+        return;
+    }
+
+    long size = (long)st.st_size;
+    int range_count = size >= PARALLEL_PARSE_MIN_BYTES ? PARSE_THREADS : 1;
+    int sport = sport_for_path(file_path);
+    bool ranking = sport >= 0 && sport_is_ranking_file(sport, file_path);
+
+    CsvRange ranges[PARSE_THREADS];
+    pthread_t threads[PARSE_THREADS];
+    for (int i = 0; i < range_count; i++) {
+        ranges[i].file_path = file_path;
+        ranges[i].buffer = buffer;
+        ranges[i].sport = sport;
+        ranges[i].ranking = ranking;
+        ranges[i].start = size / range_count * i;
+        // The last range is open ended, rows appended while we read are still taken
+        ranges[i].end = i == range_count - 1 ? LONG_MAX : size / range_count * (i + 1);
+        ranges[i].rows = 0;
+    }
+
+    for (int i = 1; i < range_count; i++) {
+        pthread_create(&threads[i], NULL, parse_range_thread, &ranges[i]);
+    }
+    parse_csv_range(&ranges[0]);
+
+    int rows = ranges[0].rows;
+    for (int i = 1; i < range_count; i++) {
+        pthread_join(threads[i], NULL);
+        rows += ranges[i].rows;
+    }
+
+    if (range_count > 1) {
+        printf("Finished reading file: %s (%d rows in %d ranges)\n", file_path, rows, range_count);
+    } else {
+        printf("Finished reading file: %s\n", file_path);
+    }
 
     end_hotspot(&buffer->profiler, "csv_file_processing");
 }
 
+typedef struct {
+    ZipArchive* archive;
+    const char* archive_path;
+    SharedBuffer* buffer;
+    int* members;       // indexes of the CSV members to stream
+    int member_count;
+    int next;           // next member to take, claimed with an atomic add
+    int rows;
+} ZipJob;
+
+typedef struct {
+    SharedBuffer* buffer;
+    int sport;       // routed like the rows of a file at "<archive>/<member>"
+    bool ranking;
+    RowBatch batch;
+    long line;
+    bool stopped;
+} ZipMemberRows;
+
+static bool push_member_line(const char* line, void* context) {
+    ZipMemberRows* rows = context;
+    if (rows->line++ == 0) {
+        return true; // Skip header
+    }
+    if (!push_row(rows->buffer, &rows->batch, line, rows->sport, rows->ranking)) {
+        rows->stopped = true;
+        return false;
+    }
+    return true;
+}
+
+/*
+    Decompression thread: takes the next member of the archive and streams its rows into the
+    shared buffer while the consumers parse the rows that are already there
+*/
+static void* zip_member_thread(void* arg) {
+    ZipJob* job = (ZipJob*)arg;
+    sampler_thread_start("zip_member");
+
+    int index;
+    while ((index = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->member_count) {
+        const ZipMember* member = &job->archive->members[job->members[index]];
+        char file_path[MAX_PATH];
+        snprintf(file_path, sizeof(file_path), "%s/%s", job->archive_path, member->name);
+
+        int sport = sport_for_path(file_path);
+        bool ranking = sport >= 0 && sport_is_ranking_file(sport, file_path);
+        ZipMemberRows rows = { job->buffer, sport, ranking, { NULL, 0 }, 0, false };
+        if (!init_row_batch(job->buffer, &rows.batch)) {
+            break;
+        }
+        long lines = zip_read_member(job->archive, member, push_member_line, &rows);
+        if (!rows.stopped && !flush_rows(job->buffer, &rows.batch)) {
+            rows.stopped = true;
+        }
+        free(rows.batch.rows);
+        if (lines < 0) {
+            printf("Error reading zip member: %s\n", file_path);
+        } else {
+            __atomic_fetch_add(&job->rows, (int)(rows.line > 0 ? rows.line - 1 : 0), __ATOMIC_RELAXED);
+            printf("Finished reading file: %s\n", file_path);
+        }
+        if (rows.stopped) {
+            break;
+        }
+    }
+
+    sampler_thread_stop();
+    return NULL;
+}
+
+static bool is_csv_name(const char* name) {
+    size_t len = strlen(name);
+    return len > 4 && strcmp(name + len - 4, ".csv") == 0;
+}
+
+/*
+    Reads the CSV members of a zip archive without extracting it. Up to ZIP_THREADS members are
+    decompressed at the same time, each on its own thread, so inflating overlaps with parsing
+*/
+void process_zip_archive(const char* archive_path, SharedBuffer* buffer) {
+    start_hotspot(&buffer->profiler, "zip_archive_processing");
+
+    ZipArchive archive;
+    if (!zip_open(&archive, archive_path)) {
+        end_hotspot(&buffer->profiler, "zip_archive_processing");
+        return;
+    }
+
+    int* members = malloc((archive.member_count + 1) * sizeof(int));
+    int member_count = 0;
+    for (int i = 0; members != NULL && i < archive.member_count; i++) {
+        // Players are read by the producer itself at the start of the phase
+        if (is_csv_name(archive.members[i].name) && strstr(archive.members[i].name, "atp_players") == NULL) {
+            members[member_count++] = i;
+        }
+    }
+
+    ZipJob job = { &archive, archive_path, buffer, members, member_count, 0, 0 };
+    int thread_count = member_count < ZIP_THREADS ? member_count : ZIP_THREADS;
+    pthread_t threads[ZIP_THREADS];
+    for (int i = 0; i < thread_count; i++) {
+        pthread_create(&threads[i], NULL, zip_member_thread, &job);
+    }
+    for (int i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    printf("Finished reading archive: %s (%d rows from %d members on %d threads)\n",
+           archive_path, job.rows, member_count, thread_count);
+
+    free(members);
+    zip_close(&archive);
+    end_hotspot(&buffer->profiler, "zip_archive_processing");
+}
+
+/*
+    A data file cut into chunk tasks for the steal schedule: byte ranges of a CSV file or the
+    members of a zip archive. The chunks share it, the worker finishing the last one reports it
+*/
+typedef struct {
+    char path[MAX_PATH];
+    int sport;            // CSV files, the members of an archive are routed one by one
+    bool ranking;
+    bool zip;
+    ZipArchive archive;   // open until the last member is read
+    int* members;         // CSV members of the archive, the start of a task indexes them
+    int tasks;
+    int tasks_left;
+    int rows;
+} ChunkFile;
+
+typedef struct {
+    SharedBuffer* buffer;
+    int sport;
+    bool ranking;
+    long line;
+} ChunkRows;
+
+static bool sport_loaded(SharedBuffer* buffer, int sport) {
+    return sport >= 0 && buffer->sports[sport].players != NULL;
+}
+
+static bool aggregate_chunk_line(const char* line, void* context) {
+    ChunkRows* rows = context;
+    aggregate_row(rows->buffer, rows->sport, rows->ranking, line);
+    return true;
+}
+
+static bool aggregate_member_line(const char* line, void* context) {
+    ChunkRows* rows = context;
+    if (rows->line++ == 0) {
+        return true; // Skip header
+    }
+    return aggregate_chunk_line(line, context);
+}
+
+static void free_chunk_file(ChunkFile* file) {
+    if (file->zip) {
+        free(file->members);
+        zip_close(&file->archive);
+    }
+    free(file);
+}
+
+static void finish_chunk(ChunkFile* file, long rows) {
+    __atomic_fetch_add(&file->rows, (int)rows, __ATOMIC_RELAXED);
+    if (__atomic_sub_fetch(&file->tasks_left, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+    if (file->zip) {
+        printf("Finished reading archive: %s (%d rows from %d members)\n", file->path, file->rows, file->tasks);
+    } else if (file->tasks > 1) {
+        printf("Finished reading file: %s (%d rows in %d chunks)\n", file->path, file->rows, file->tasks);
+    } else {
+        printf("Finished reading file: %s\n", file->path);
+    }
+    free_chunk_file(file);
+}
+
+static void run_csv_chunk(ChunkTask* task, void* context) {
+    ChunkFile* file = task->file;
+    ChunkRows rows = { context, file->sport, file->ranking, 0 };
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    long count = read_csv_range(file->path, task->start, task->end, aggregate_chunk_line, &rows);
+    if (count > 0) {
+        add_aggregation_time(context, file->sport, file->ranking, &started, count);
+    }
+    finish_chunk(file, count > 0 ? count : 0);
+}
+
+static void run_zip_member(ChunkTask* task, void* context) {
+    ChunkFile* file = task->file;
+    const ZipMember* member = &file->archive.members[file->members[task->start]];
+    char member_path[MAX_PATH + ZIP_MAX_NAME];
+    snprintf(member_path, sizeof(member_path), "%s/%s", file->path, member->name);
+
+    // Routed like the rows of a file at "<archive>/<member>"
+    int sport = sport_for_path(member_path);
+    ChunkRows rows = { context, sport, sport >= 0 && sport_is_ranking_file(sport, member_path), 0 };
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    if (sport_loaded(context, sport) && zip_read_member(&file->archive, member, aggregate_member_line, &rows) < 0) {
+        printf("Error reading zip member: %s\n", member_path);
+    }
+    if (rows.line > 1) {
+        add_aggregation_time(context, sport, rows.ranking, &started, rows.line - 1);
+    }
+    finish_chunk(file, rows.line > 0 ? rows.line - 1 : 0);
+}
+
+/*
+    Steal schedule: cuts a data file into chunk tasks and queues them on the workers. CSV files
+    become newline aligned ranges of about CHUNK_TASK_BYTES, archives one task per CSV member.
+    Waits while the workers have enough queued, so the prefetch window stays ahead of them
+*/
+static void submit_chunk_tasks(SharedBuffer* buffer, const char* path, bool zip) {
+    ChunkFile* file = calloc(1, sizeof(ChunkFile));
+    if (file == NULL) {
+        return;
+    }
+    snprintf(file->path, sizeof(file->path), "%s", path);
+    file->zip = zip;
+    ChunkTask task = { zip ? run_zip_member : run_csv_chunk, file, 0, 0 };
+    long size = 0;
+
+    if (zip) {
+        if (!zip_open(&file->archive, path)) {
+            free(file);
+            return;
+        }
+        file->members = malloc((file->archive.member_count + 1) * sizeof(int));
+        for (int i = 0; file->members != NULL && i < file->archive.member_count; i++) {
+            // Players are read by the producer itself at the start of the phase
+            if (is_csv_name(file->archive.members[i].name) && strstr(file->archive.members[i].name, "atp_players") == NULL) {
+                file->members[file->tasks++] = i;
+            }
+        }
+    } else {
+        struct stat st;
+        if (stat(path, &st) != 0) {
+            printf("Error opening file: %s\n", path);
+            free(file);
+            return;
+        }
+        file->sport = sport_for_path(path);
+        file->ranking = file->sport >= 0 && sport_is_ranking_file(file->sport, path);
+        size = (long)st.st_size;
+        file->tasks = sport_loaded(buffer, file->sport) ? (int)(size / CHUNK_TASK_BYTES) + 1 : 0;
+    }
+
+    int tasks = file->tasks;
+    if (tasks == 0) {
+        free_chunk_file(file);
+        return;
+    }
+    // The file may be freed by a worker as soon as the last task is queued
+    file->tasks_left = tasks;
+    for (int i = 0; i < tasks; i++) {
+        if (zip) {
+            task.start = i;
+        } else {
+            task.start = size / tasks * i;
+            // The last range is open ended, rows appended while we read are still taken
+            task.end = i == tasks - 1 ? LONG_MAX : size / tasks * (i + 1);
+        }
+        scheduler_submit(&buffer->scheduler, &task);
+    }
+}
+
+// Data files of a directory walk in readdir order, the prefetcher needs to know what comes next
+typedef struct {
+    char (*paths)[PREFETCH_PATH];
+    int count;
+    int capacity;
+} DataFileList;
+
 /*
     The folders contain a lot of csv files and I decided to use a recursive function to search for them
+    Zip archives are read in place, see process_zip_archive
 */
-void search_csv_files(const char* dir_path, SharedBuffer* buffer) {
+static void collect_data_files(const char* dir_path, DataFileList* list) {
     DIR* dir;
     struct dirent* entry;
     char path[MAX_PATH];
@@ -87,249 +524,397 @@ void search_csv_files(const char* dir_path, SharedBuffer* buffer) {
         snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
 
         if(entry->d_type == DT_DIR) {
-            search_csv_files(path, buffer);
-        } else {
-            size_t len = strlen(entry->d_name);
-            if (len > 4 && strcmp(entry->d_name + len - 4, ".csv") == 0) {
-                
-                if(strstr(path, "atp_players") != NULL) { // already processed players in producer
-                    continue;
-                }
-
-                strcpy(buffer->entries[buffer->in].filename, path);
-                
-                process_csv_file(path, buffer);
+            collect_data_files(path, list);
+            continue;
+        }
+        size_t len = strlen(entry->d_name);
+        bool csv = len > 4 && strcmp(entry->d_name + len - 4, ".csv") == 0;
+        bool zip = len > 4 && strcmp(entry->d_name + len - 4, ".zip") == 0;
+        if ((!csv && !zip) || (csv && strstr(path, "atp_players") != NULL)) { // already processed players in producer
+            continue;
+        }
+        if (list->count == list->capacity) {
+            int capacity = list->capacity == 0 ? 16 : list->capacity * 2;
+            void* paths = realloc(list->paths, (size_t)capacity * sizeof(*list->paths));
+            if (paths == NULL) {
+                break;
             }
+            list->paths = paths;
+            list->capacity = capacity;
         }
+        snprintf(list->paths[list->count++], PREFETCH_PATH, "%s", path);
     }
 
     closedir(dir);
 }
 
 /*
-    Function to read football players from a CSV file and add them to the shared buffer
+    Parses every data file under dir_path. The walk is done first, so while one file is parsed
+    the next options.prefetch_window files are already being read into the page cache
 */
-void read_football_players_in_shared_buffer(SharedBuffer *buffer)
-{
-    FILE* file = fopen("data/football/atp_players.csv", "r");
-    if (file == NULL) {
-        printf("Error opening file: %s\n", "data/football/atp_players.csv");
-        return;
+void search_csv_files(const char* dir_path, SharedBuffer* buffer) {
+    DataFileList list = {NULL, 0, 0};
+    collect_data_files(dir_path, &list);
+
+    Prefetcher prefetcher;
+    prefetch_start(&prefetcher, (const char (*)[PREFETCH_PATH])list.paths, list.count,
+                   buffer->options.prefetch_window, buffer->options.prefetch_thread);
+    for (int i = 0; i < list.count; i++) {
+        prefetch_advance(&prefetcher, i);
+        size_t len = strlen(list.paths[i]);
+        bool zip = strcmp(list.paths[i] + len - 4, ".zip") == 0;
+        if (buffer->options.schedule == SCHEDULE_STEAL) {
+            submit_chunk_tasks(buffer, list.paths[i], zip);
+        } else if (zip) {
+            process_zip_archive(list.paths[i], buffer);
+        } else {
+            process_csv_file(list.paths[i], buffer);
+        }
     }
-    char line[1024];
-    fgets(line, sizeof(line), file); // Skip header
-    while (fgets(line, sizeof(line), file)) {
-        // Remove newline character
-        line[strcspn(line, "\n")] = 0;
-        
-        // Add data to buffer
-        pthread_mutex_lock(&buffer->mutex);
-        while (buffer->count == buffer->size) { 
-            pthread_cond_wait(&buffer->not_full, &buffer->mutex);
+    prefetch_stop(&prefetcher);
+
+    if (prefetcher.files > 0) {
+        printf("Prefetched %d of %d files of %s (%zu KB, window %d%s)\n", prefetcher.files, list.count,
+               dir_path, prefetcher.bytes / 1024, prefetcher.window, prefetcher.threaded ? ", thread" : "");
+    }
+    free(list.paths);
+}
+
+/*
+    Opens <sport_dir>/atp_players.csv, or, when only the archives are there, the atp_players.csv
+    member of the first zip archive in sport_dir that has one (decompressed into a memory stream).
+    The number of data rows goes to *rows
+*/
+static FILE* open_players_file(const char* sport_dir, int* rows) {
+    char path[MAX_PATH];
+    snprintf(path, sizeof(path), "%s/atp_players.csv", sport_dir);
+    FILE* file = fopen(path, "r");
+    if (file != NULL) {
+        *rows = count_csv_rows(path);
+        return file;
+    }
+
+    DIR* dir = opendir(sport_dir);
+    struct dirent* entry;
+    while (dir != NULL && file == NULL && (entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len <= 4 || strcmp(entry->d_name + len - 4, ".zip") != 0) {
+            continue;
         }
-        
-        char *p=strtok(line, ",");
-        int i=0;
-        while(p!=NULL)
-        {
-            switch(i)
-            {
-                case 0:
-                    buffer->players[buffer->player_count].player_id = atoi(p);
-                    break;
-                case 1:
-                    strcpy(buffer->players[buffer->player_count].name_first, p);
-                    break;
-                case 2:
-                    strcpy(buffer->players[buffer->player_count].name_last, p);
-                    break;
+        snprintf(path, sizeof(path), "%s/%s", sport_dir, entry->d_name);
+        ZipArchive archive;
+        if (!zip_open(&archive, path)) {
+            continue;
+        }
+        int member = zip_find_member(&archive, "atp_players.csv");
+        size_t size = 0;
+        char* data = member >= 0 ? zip_extract_member(&archive, &archive.members[member], &size) : NULL;
+        zip_close(&archive);
+        if (data == NULL) {
+            continue;
+        }
+
+        // fmemopen(NULL, ...) owns its buffer, it is freed by fclose
+        file = fmemopen(NULL, size + 1, "w+");
+        if (file != NULL) {
+            fwrite(data, 1, size, file);
+            rewind(file);
+            int lines = 0;
+            for (char* p = data; (p = memchr(p, '\n', data + size - p)) != NULL; p++) {
+                lines++;
             }
-            p=strtok(NULL, ",");
-            i++;
+            if (size > 0 && data[size - 1] != '\n') {
+                lines++;
+            }
+            *rows = lines > 0 ? lines - 1 : 0;
+            printf("Reading players from archive: %s\n", path);
         }
-        buffer->player_count++;
-        
-        pthread_cond_signal(&buffer->not_empty);
-        pthread_mutex_unlock(&buffer->mutex);
+        free(data);
     }
-
-    printf("Finished adding football players to buffer, size %d\n", buffer->player_count);
+    if (dir != NULL) {
+        closedir(dir);
+    }
+    if (file == NULL) {
+        printf("Error opening file: %s/atp_players.csv\n", sport_dir);
+    }
+    return file;
 }
 
 /*
-    Function to read tennis players from a CSV file and add them to the shared buffer
+    Function to read the players of a sport from its CSV file into the sport state
 */
-void read_tennis_players_in_shared_buffer(SharedBuffer *buffer)
+void read_players_in_shared_buffer(SharedBuffer *buffer, int sport)
 {
-    FILE* file = fopen("data/tennis/atp_players.csv", "r");
+    const SportDescriptor* descriptor = &sport_descriptors[sport];
+    SportState* state = &buffer->sports[sport];
+    int rows = 0;
+    FILE* file = open_players_file(descriptor->data_dir, &rows);
     if (file == NULL) {
-        printf("Error opening file: %s\n", "data/tennis/atp_players.csv");
         return;
     }
+
+    // Size the sport arena from the real number of players. The table is filled before any
+    // row of the sport is pushed, the consumers only start taking rows after that
+    pthread_mutex_lock(&buffer->mutex);
+    int ok = prepare_sport_state(buffer, state, rows);
+    pthread_mutex_unlock(&buffer->mutex);
+    if (!ok) {
+        printf("Error allocating %s player table\n", descriptor->name);
+        fclose(file);
+        return;
+    }
+
     char line[1024];
     fgets(line, sizeof(line), file); // Skip header
     while (fgets(line, sizeof(line), file)) {
         // Remove newline character
         line[strcspn(line, "\n")] = 0;
         
-        // Add data to buffer
         pthread_mutex_lock(&buffer->mutex);
-        while (buffer->count == buffer->size) { 
-            pthread_cond_wait(&buffer->not_full, &buffer->mutex);
-        }
-        
-        char *p=strtok(line, ",");
-        int i=0;
-        while(p!=NULL)
-        {
-            switch(i)
-            {
-                case 0:
-                    buffer->players[buffer->player_count].player_id = atoi(p);
-                    break;
-                case 1:
-                    strcpy(buffer->players[buffer->player_count].name_first, p);
-                    break;
-                case 2:
-                    strcpy(buffer->players[buffer->player_count].name_last, p);
-                    break;
-            }
-            p=strtok(NULL, ",");
-            i++;
-        }
-        buffer->player_count++;
-        
-        pthread_cond_signal(&buffer->not_empty);
+        add_player_from_csv_line(buffer, state, line);
         pthread_mutex_unlock(&buffer->mutex);
     }
+    fclose(file);
 
-    printf("Finished adding tennis players to buffer, size %d\n", buffer->player_count);
+    printf("Finished adding %s players to buffer, size %d\n", descriptor->name, state->player_count);
 }
 
-// TODO: Implement the rest for basketball
-
 /*
     Function to generate a phase report based on the data in the shared buffer
-    The report is written to a file and contains the player with the max points and the top 10 PPA players
+    The report contains the player with the max points and the top 10 PPA players
+    It is formatted in memory and handed to the async writer, which replaces the file atomically
+    at the next phase boundary, so it can be regenerated while someone is reading it (watch mode)
     Also, a callback function is used to print the top 10 PPA players
 */
-void generate_phase_report(SharedBuffer* buffer, ReportCallback callback, const char* filename, bool is_football) {
-    FILE* report = fopen(filename, "w");
+void generate_phase_report(SharedBuffer* buffer, ReportCallback callback, int sport) {
+    const SportDescriptor* descriptor = &sport_descriptors[sport];
+    SportState* state = &buffer->sports[sport];
+
+    char* text = NULL;
+    size_t length = 0;
+    FILE* report = open_memstream(&text, &length);
     if (report == NULL) {
-        printf("Error opening report file: %s\n", filename);
+        printf("Error formatting report: %s\n", descriptor->report_file);
         return;
     }
 
-    const char* sport = is_football ? "Football" : "Tennis";
-    fprintf(report, "%s Results:\n", sport);
+    fprintf(report, "%s Results:\n", descriptor->title);
     
     // Print max points player info
-    Player* max_points_player = is_football ? 
-        &buffer->player_with_max_points_football : 
-        &buffer->player_with_max_points_tennis;
+    Player* max_points_player = &state->player_with_max_points;
+    Player* best = find_player_with_max_points(state);
+    if (best != NULL) {
+        *max_points_player = *best;
+    }
     
     fprintf(report, "Player with max points: %s %s, points: %d\n",
-            max_points_player->name_first,
-            max_points_player->name_last,
+            max_points_player->name_first ? max_points_player->name_first : "",
+            max_points_player->name_last ? max_points_player->name_last : "",
             max_points_player->points);
+
+    if (buffer->options.range_from > 0 && !state->date_index.built) {
+        fprintf(report, "No date index for this phase (memory budget), range not available\n");
+    } else if (buffer->options.range_from > 0) {
+        double best_avg = 0.0;
+        int best_range = date_index_best_average(&state->date_index, buffer->options.range_from,
+                                                 buffer->options.range_to, &best_avg);
+        if (best_range >= 0) {
+            Player* player = &state->players[best_range];
+            fprintf(report, "Best average points per tournament between %d and %d: %s %s, %.2f\n",
+                    buffer->options.range_from, buffer->options.range_to,
+                    player->name_first ? player->name_first : "",
+                    player->name_last ? player->name_last : "", best_avg);
+        } else {
+            fprintf(report, "No ranking points between %d and %d\n",
+                    buffer->options.range_from, buffer->options.range_to);
+        }
+    }
     
     // Print top 10 PPA players using callback
     fprintf(report, "\nTop 10 PPA Players:\n");
-    callback(buffer, report, is_football);
+    callback(buffer, state, report);
     
     fclose(report);
+    async_writer_replace(descriptor->report_file, text, length);
+    free(text);
 }
 
 
 /*
-    Producer thread function
-    The producer reads football and tennis players from CSV files and adds them to the shared buffer
-    After adding all players, the producer waits for the consumers to finish processing the data
-    Then, it generates a report for each phase and signals the completion of the processing
+    Tells the consumers that every row of the current batch is in the buffer
+    and waits until they processed all of them. The date index is then rebuilt
+    of every loaded sport from its ranking log, so range queries never go back to the CSV files
 */
-void* producer_thread(void* arg) {
-    ProducerArgs* args = (ProducerArgs*)arg;
-    SharedBuffer* buffer = args->buffer;
-    //int producer_id = args->producer_id;
-    FILE *football_report, *tennis_report;
-
-    // Phase 1: Football processing
-    football_report = fopen("football_report.txt", "w");
-    if (football_report == NULL) {
-        printf("Error opening football report file\n");
-        return NULL;
-    }
-
-    start_hotspot(&buffer->profiler, "football_phase");
-    printf("Starting football phase...\n");
-    read_football_players_in_shared_buffer(buffer);
-    search_csv_files("data/football", buffer);
-    end_hotspot(&buffer->profiler, "football_phase");
-    
-    // Signal end of football data
+void finish_phase_batch(SharedBuffer* buffer) {
     pthread_mutex_lock(&buffer->mutex);
     buffer->phase_data_processed = true;
     pthread_cond_broadcast(&buffer->not_empty);
     pthread_mutex_unlock(&buffer->mutex);
+    scheduler_close(&buffer->scheduler);
 
-    // Wait for consumers to finish football processing
     pthread_mutex_lock(&buffer->completion_mutex);
     while (buffer->active_consumers > 0) {
         pthread_cond_wait(&buffer->all_done, &buffer->completion_mutex);
     }
     pthread_mutex_unlock(&buffer->completion_mutex);
 
-    // Print football results
-    generate_phase_report(buffer, print_top_ppa_players, "football_report.txt", true);
+    TailIdle tail;
+    scheduler_tail_idle(&buffer->scheduler, phase_name(buffer->current_phase), &tail);
+    record_tail_idle(&buffer->profiler, &tail);
+    printf("Tail idle of %s: %.3f ms over %d workers (max %.3f ms), %lu tasks, %lu stolen\n",
+           tail.name, tail.idle_total * 1000.0, tail.workers, tail.idle_max * 1000.0, tail.tasks, tail.steals);
 
-    // Phase 2: Tennis processing
-    tennis_report = fopen("tennis_report.txt", "w");
-    if (tennis_report == NULL) {
-        printf("Error opening tennis report file\n");
-        return NULL;
+    start_hotspot(&buffer->profiler, "date_index");
+    pthread_mutex_lock(&buffer->mutex);
+    for (int i = 0; i < SPORT_COUNT; i++) {
+        if (buffer->sports[i].players != NULL) {
+            rebuild_date_index(buffer, &buffer->sports[i]);
+        }
+    }
+    pthread_mutex_unlock(&buffer->mutex);
+    end_hotspot(&buffer->profiler, "date_index");
+}
+
+/*
+    Starts a new batch of rows for the given phase. A batch is either a whole phase or, in watch mode,
+    the files that arrived together. Consumers wake up on the generation counter, so a new batch
+    of the same phase wakes them as well
+*/
+void start_phase_batch(SharedBuffer* buffer, ProcessingPhase phase) {
+    if (phase != buffer->current_phase) {
+        memory_phase_begin(&buffer->profiler, phase_name(phase));
     }
 
-    // Switch to tennis phase
     pthread_mutex_lock(&buffer->phase_mutex);
-    buffer->current_phase = PHASE_TENNIS;
+    buffer->current_phase = phase;
+    pthread_mutex_lock(&buffer->mutex);
     buffer->phase_data_processed = false;
-    buffer->player_count = 0; // Reset player count for tennis
-    memset(buffer->players, 0, sizeof(Player) * 66000); // Reset player data
+    pthread_mutex_unlock(&buffer->mutex);
+    if (phase != PHASE_DONE) {
+        pthread_mutex_lock(&buffer->completion_mutex);
+        buffer->active_consumers = buffer->num_consumers;
+        pthread_mutex_unlock(&buffer->completion_mutex);
+        scheduler_open(&buffer->scheduler);
+    }
+    buffer->phase_generation++;
     pthread_cond_broadcast(&buffer->phase_change);
     pthread_mutex_unlock(&buffer->phase_mutex);
+}
 
-    printf("Starting tennis phase...\n");
-    start_hotspot(&buffer->profiler, "tennis_phase");
-    read_tennis_players_in_shared_buffer(buffer);
-    search_csv_files("data/tennis", buffer);
-    end_hotspot(&buffer->profiler, "tennis_phase");
-
-    // Signal end of tennis data
+/*
+    Hands the state of a finished sport over: to the query server when it runs, otherwise it is reset
+*/
+static void release_sport(SharedBuffer* buffer, int sport) {
     pthread_mutex_lock(&buffer->mutex);
-    buffer->phase_data_processed = true;
-    pthread_cond_broadcast(&buffer->not_empty);
+    if (buffer->sports[sport].players != NULL) {
+        if (buffer->query_server != NULL) {
+            query_server_publish_phase(buffer->query_server, buffer, sport); // the server keeps the state
+        } else {
+            reset_sport_state(buffer, &buffer->sports[sport]); // O(1), the arena pages are handed back
+        }
+    }
     pthread_mutex_unlock(&buffer->mutex);
+}
 
-    // Wait for consumers to finish tennis processing
-    pthread_mutex_lock(&buffer->completion_mutex);
-    while (buffer->active_consumers > 0) {
-        pthread_cond_wait(&buffer->all_done, &buffer->completion_mutex);
+static bool sport_has_data(int sport) {
+    struct stat st;
+    if (stat(sport_descriptors[sport].data_dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        printf("Skipping %s, no %s directory\n", sport_descriptors[sport].name, sport_descriptors[sport].data_dir);
+        return false;
     }
-    pthread_mutex_unlock(&buffer->completion_mutex);
+    return true;
+}
 
-    // Print tennis results
-    generate_phase_report(buffer, print_top_ppa_players, "tennis_report.txt", false);
+/*
+    Single pass: the players of every sport are loaded up front, then the files of all sports
+    go through the pipeline as one batch. The workers aggregate each row into the state of its
+    sport, so the consumers never wait at a phase boundary between two sports
+*/
+static void run_single_pass(SharedBuffer* buffer) {
+    bool present[SPORT_COUNT];
+
+    start_hotspot(&buffer->profiler, "all_sports_phase");
+    printf("Starting single pass over all sports...\n");
+    for (int i = 0; i < SPORT_COUNT; i++) {
+        present[i] = sport_has_data(i);
+        if (present[i]) {
+            read_players_in_shared_buffer(buffer, i);
+        }
+    }
+    for (int i = 0; i < SPORT_COUNT; i++) {
+        if (present[i]) {
+            search_csv_files(sport_descriptors[i].data_dir, buffer);
+        }
+    }
+    end_hotspot(&buffer->profiler, "all_sports_phase");
+
+    finish_phase_batch(buffer);
 
-    //TO:DO - for basketball, use a different callback function to use the callback more effectively
+    for (int i = 0; i < SPORT_COUNT; i++) {
+        if (present[i]) {
+            generate_phase_report(buffer, print_top_ppa_players, i);
+            release_sport(buffer, i);
+        }
+    }
+    async_writer_sync();
+}
+
+/*
+    Producer thread function
+    The producer goes through the sports in descriptor order: it reads the players of the sport,
+    adds the rows of its files to the shared buffer and waits for the consumers to finish them.
+    Then it generates the report of the sport and moves on to the next one, finally it signals the
+    completion of the processing. With --single-pass all sports are one batch instead
+    In watch mode the producer hands over to run_watch_mode after the initial load
+*/
+void* producer_thread(void* arg) {
+    ProducerArgs* args = (ProducerArgs*)arg;
+    SharedBuffer* buffer = args->buffer;
+    //int producer_id = args->producer_id;
+    sampler_thread_start("producer");
+
+    if (buffer->options.watch_phase != PHASE_DONE) {
+        run_watch_mode(buffer, buffer->options.watch_phase);
+        sampler_thread_stop();
+        free(arg);
+        return NULL;
+    }
+
+    if (buffer->options.single_pass) {
+        run_single_pass(buffer);
+    } else {
+        for (int sport = 0; sport < SPORT_COUNT; sport++) {
+            const SportDescriptor* descriptor = &sport_descriptors[sport];
+            // The consumers start in the first phase, every later sport is a new batch
+            if (sport > 0) {
+                start_phase_batch(buffer, (ProcessingPhase)sport);
+            }
+            if (!sport_has_data(sport)) {
+                finish_phase_batch(buffer);
+                continue;
+            }
+
+            printf("Starting %s phase...\n", descriptor->name);
+            start_hotspot(&buffer->profiler, descriptor->phase_hotspot);
+            read_players_in_shared_buffer(buffer, sport);
+            search_csv_files(descriptor->data_dir, buffer);
+            end_hotspot(&buffer->profiler, descriptor->phase_hotspot);
+
+            // Signal end of the sport's data and wait for consumers to finish it
+            finish_phase_batch(buffer);
+
+            generate_phase_report(buffer, print_top_ppa_players, sport);
+            release_sport(buffer, sport);
+            async_writer_sync(); // phase boundary, the report becomes visible with it
+        }
+    }
 
     // Signal completion
-    pthread_mutex_lock(&buffer->phase_mutex);
-    buffer->current_phase = PHASE_DONE;
-    pthread_cond_broadcast(&buffer->phase_change);
-    pthread_mutex_unlock(&buffer->phase_mutex);
+    start_phase_batch(buffer, PHASE_DONE);
 
     buffer->all_data_processed = true;
     
+    sampler_thread_stop();
     free(arg);
     return NULL;
 }
@@ -1,10 +1,50 @@
 // profiling.c
+#define _GNU_SOURCE
 #include "profiling.h"
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <pthread.h>
 #include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <sys/mman.h>
 #include "utils.h"
+#include "async_writer.h"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+#define SAMPLER_SKIP_FRAMES 2 // the signal handler and the signal trampoline
+
+typedef struct {
+    int thread;  // index in sampler.threads
+    int depth;
+    int weight;  // timer periods covered by this sample, see sampler_signal
+    void* frames[SAMPLER_MAX_FRAMES];
+} Sample;
+
+// The signal handler can only reach global state
+static struct {
+    volatile sig_atomic_t enabled;
+    int hz;
+    Sample* samples;              // mmap'ed, pages are only touched when samples land in them
+    long next;                    // next free sample, claimed with an atomic add
+    char threads[SAMPLER_MAX_THREADS][MAX_NAME_LENGTH];
+    int thread_count;
+    pthread_mutex_t threads_mutex;
+} sampler = { .threads_mutex = PTHREAD_MUTEX_INITIALIZER };
+
+// Start of the hotspots open on this thread, so several workers can be inside the same hotspot
+static __thread struct timespec hotspot_started[MAX_HOTSPOTS];
+
+static __thread int sampler_thread = -1;
+static __thread timer_t sampler_timer;
 
 void init_profiler(ProfilerData* profiler) {
     gettimeofday(&profiler->start_time, NULL);
@@ -22,29 +62,41 @@ void init_profiler(ProfilerData* profiler) {
         profiler->hotspots[i].total_time = 0.0;
         memset(profiler->hotspots[i].name, 0, MAX_NAME_LENGTH);
     }
+
+    memset(&profiler->handoff, 0, sizeof(profiler->handoff));
+    profiler->tail_idle_count = 0;
+    memset(profiler->memory, 0, sizeof(profiler->memory));
+    profiler->memory_total = 0;
+    profiler->memory_phase_peak = 0;
+    profiler->memory_phase[0] = '\0';
+    profiler->memory_phase_count = 0;
+    profiler->memory_budget = 0;
+    profiler->budget_policy = BUDGET_ABORT;
+    profiler->budget_degradations = 0;
     
     pthread_mutex_init(&profiler->profile_mutex, NULL);
 }
 
-void start_hotspot(ProfilerData* profiler, const char* name) {
-    pthread_mutex_lock(&profiler->profile_mutex);
-    
-    // Find or create hotspot
-    int index = -1;
+// Finds or creates the slot of a hotspot, -1 when the table is full. Caller holds profile_mutex
+static int hotspot_slot(ProfilerData* profiler, const char* name) {
     for (int i = 0; i < MAX_HOTSPOTS; i++) {
         if (strcmp(profiler->hotspots[i].name, name) == 0) {
-            index = i;
-            break;
+            return i;
         }
         if (profiler->hotspots[i].name[0] == '\0') {
-            index = i;
             strncpy(profiler->hotspots[i].name, name, MAX_NAME_LENGTH - 1);
-            break;
+            return i;
         }
     }
+    return -1;
+}
+
+void start_hotspot(ProfilerData* profiler, const char* name) {
+    pthread_mutex_lock(&profiler->profile_mutex);
     
+    int index = hotspot_slot(profiler, name);
     if (index != -1) {
-        clock_gettime(CLOCK_MONOTONIC, &profiler->hotspots[index].start);
+        clock_gettime(CLOCK_MONOTONIC, &hotspot_started[index]);
     }
     
     pthread_mutex_unlock(&profiler->profile_mutex);
@@ -58,8 +110,8 @@ void end_hotspot(ProfilerData* profiler, const char* name) {
     
     for (int i = 0; i < MAX_HOTSPOTS; i++) {
         if (strcmp(profiler->hotspots[i].name, name) == 0) {
-            double elapsed = (end.tv_sec - profiler->hotspots[i].start.tv_sec) + 
-                             (end.tv_nsec - profiler->hotspots[i].start.tv_nsec) / 1000000000.0;
+            double elapsed = (end.tv_sec - hotspot_started[i].tv_sec) + 
+                             (end.tv_nsec - hotspot_started[i].tv_nsec) / 1000000000.0;
             
             profiler->hotspots[i].total_time += elapsed;
             profiler->hotspots[i].count++;
@@ -70,6 +122,179 @@ void end_hotspot(ProfilerData* profiler, const char* name) {
     pthread_mutex_unlock(&profiler->profile_mutex);
 }
 
+/*
+    Adds time measured by the caller to a hotspot, as `count` calls. Hot loops time a whole
+    batch themselves and report it here once, instead of a start/end pair around every item
+*/
+void add_hotspot_time(ProfilerData* profiler, const char* name, double elapsed, int count) {
+    pthread_mutex_lock(&profiler->profile_mutex);
+    int index = hotspot_slot(profiler, name);
+    if (index != -1) {
+        profiler->hotspots[index].total_time += elapsed;
+        profiler->hotspots[index].count += count;
+    }
+    pthread_mutex_unlock(&profiler->profile_mutex);
+}
+
+static const char* memory_subsystem_names[MEM_SUBSYSTEM_COUNT] = {
+    "ring_entries", "player_table", "tourney_sets", "player_index",
+    "date_index", "report_temp", "query_server"
+};
+
+// Caller holds profile_mutex
+static void account_bytes(ProfilerData* profiler, MemorySubsystem subsystem, size_t bytes) {
+    MemoryAccount* account = &profiler->memory[subsystem];
+    account->current += bytes;
+    if (account->current > account->peak) {
+        account->peak = account->current;
+    }
+    if (account->current > account->phase_peak) {
+        account->phase_peak = account->current;
+    }
+    profiler->memory_total += bytes;
+    if (profiler->memory_total > profiler->memory_phase_peak) {
+        profiler->memory_phase_peak = profiler->memory_total;
+    }
+}
+
+static void print_handoff_stats(ProfilerData* profiler, FILE* file) {
+    HandoffStats* handoff = &profiler->handoff;
+    unsigned long batches = __atomic_load_n(&handoff->batches, __ATOMIC_RELAXED);
+    unsigned long rows = __atomic_load_n(&handoff->rows, __ATOMIC_RELAXED);
+    fprintf(file, "Handoff batch size: current=%d (chosen %d..%d, bounds %d..%d), %lu adjustment(s), "
+                  "%lu batches, %.1f rows per batch\n",
+            handoff->current, handoff->smallest, handoff->largest, handoff->bound_min, handoff->bound_max,
+            handoff->adjustments, batches, batches ? (double)rows / batches : 0.0);
+    fprintf(file, "  batches by size:");
+    for (int i = 0; i < HANDOFF_HISTOGRAM_BUCKETS; i++) {
+        unsigned long count = __atomic_load_n(&handoff->histogram[i], __ATOMIC_RELAXED);
+        if (count > 0) {
+            fprintf(file, " %d%s=%lu", 1 << i, i == HANDOFF_HISTOGRAM_BUCKETS - 1 ? "+" : "", count);
+        }
+    }
+    fprintf(file, "\n");
+}
+
+static void print_tail_idle(ProfilerData* profiler, FILE* file) {
+    for (int i = 0; i < profiler->tail_idle_count; i++) {
+        TailIdle* tail = &profiler->tail_idle[i];
+        fprintf(file, "Tail idle %s: %.3f ms over %d workers (max %.3f ms) in %.3f s, %lu tasks, %lu stolen\n",
+                tail->name, tail->idle_total * 1000.0, tail->workers, tail->idle_max * 1000.0, tail->span,
+                tail->tasks, tail->steals);
+    }
+}
+
+static void print_memory_accounting(ProfilerData* profiler, FILE* file) {
+    fprintf(file, "Tracked memory: %zu KB", profiler->memory_total / 1024);
+    if (profiler->memory_budget > 0) {
+        fprintf(file, " (budget %zu KB, %s, %d optional allocation(s) skipped)",
+                profiler->memory_budget / 1024,
+                profiler->budget_policy == BUDGET_ABORT ? "abort" : "degrade",
+                profiler->budget_degradations);
+    }
+    fprintf(file, "\n");
+    for (int i = 0; i < MEM_SUBSYSTEM_COUNT; i++) {
+        fprintf(file, "  %s: Current=%zu KB, Peak=%zu KB\n", memory_subsystem_names[i],
+                profiler->memory[i].current / 1024, profiler->memory[i].peak / 1024);
+    }
+    for (int p = 0; p < profiler->memory_phase_count; p++) {
+        MemoryPhase* phase = &profiler->memory_phases[p];
+        fprintf(file, "  Phase %s: Peak=%zu KB (", phase->name, phase->total_peak / 1024);
+        for (int i = 0; i < MEM_SUBSYSTEM_COUNT; i++) {
+            fprintf(file, "%s%s=%zu", i ? ", " : "", memory_subsystem_names[i], phase->peak[i] / 1024);
+        }
+        fprintf(file, ")\n");
+    }
+    if (profiler->memory_phase[0] != '\0') {
+        fprintf(file, "  Phase %s (running): Peak=%zu KB\n", profiler->memory_phase,
+                profiler->memory_phase_peak / 1024);
+    }
+}
+
+/*
+    Accounts `bytes` to a subsystem before they are allocated. Returns false when the
+    allocation must not be made: only optional allocations are refused, and only with
+    the degrade policy. Over budget with the abort policy (or for a required allocation
+    with nothing left to degrade under abort) the run stops with the accounting printed
+*/
+bool memory_reserve(ProfilerData* profiler, MemorySubsystem subsystem, size_t bytes, bool optional) {
+    pthread_mutex_lock(&profiler->profile_mutex);
+    bool over = profiler->memory_budget > 0 && profiler->memory_total + bytes > profiler->memory_budget;
+    if (over && profiler->budget_policy == BUDGET_DEGRADE && optional) {
+        profiler->budget_degradations++;
+        pthread_mutex_unlock(&profiler->profile_mutex);
+        return false;
+    }
+    if (over && profiler->budget_policy == BUDGET_ABORT) {
+        printf("Memory budget of %zu KB exceeded by %s (+%zu bytes), aborting\n",
+               profiler->memory_budget / 1024, memory_subsystem_names[subsystem], bytes);
+        print_memory_accounting(profiler, stdout);
+        pthread_mutex_unlock(&profiler->profile_mutex);
+        log_profile_data(profiler);
+        async_writer_stop(); // the log must reach the file before we exit
+        exit(EXIT_FAILURE);
+    }
+    account_bytes(profiler, subsystem, bytes);
+    pthread_mutex_unlock(&profiler->profile_mutex);
+    return true;
+}
+
+void memory_release(ProfilerData* profiler, MemorySubsystem subsystem, size_t bytes) {
+    pthread_mutex_lock(&profiler->profile_mutex);
+    MemoryAccount* account = &profiler->memory[subsystem];
+    bytes = bytes < account->current ? bytes : account->current;
+    account->current -= bytes;
+    profiler->memory_total -= bytes;
+    pthread_mutex_unlock(&profiler->profile_mutex);
+}
+
+// Ownership change of memory that stays allocated, never checked against the budget
+void memory_transfer(ProfilerData* profiler, MemorySubsystem from, MemorySubsystem to, size_t bytes) {
+    pthread_mutex_lock(&profiler->profile_mutex);
+    MemoryAccount* account = &profiler->memory[from];
+    bytes = bytes < account->current ? bytes : account->current;
+    account->current -= bytes;
+    profiler->memory_total -= bytes;
+    account_bytes(profiler, to, bytes);
+    pthread_mutex_unlock(&profiler->profile_mutex);
+}
+
+/*
+    Closes the running memory phase (its peaks are kept for the log) and starts a new one,
+    NULL only closes it
+*/
+void memory_phase_begin(ProfilerData* profiler, const char* name) {
+    pthread_mutex_lock(&profiler->profile_mutex);
+    if (profiler->memory_phase[0] != '\0' && profiler->memory_phase_count < MAX_MEMORY_PHASES) {
+        MemoryPhase* phase = &profiler->memory_phases[profiler->memory_phase_count++];
+        snprintf(phase->name, MAX_NAME_LENGTH, "%s", profiler->memory_phase);
+        for (int i = 0; i < MEM_SUBSYSTEM_COUNT; i++) {
+            phase->peak[i] = profiler->memory[i].phase_peak;
+        }
+        phase->total_peak = profiler->memory_phase_peak;
+    }
+
+    profiler->memory_phase[0] = '\0';
+    if (name != NULL) {
+        strncpy(profiler->memory_phase, name, MAX_NAME_LENGTH - 1);
+        profiler->memory_phase[MAX_NAME_LENGTH - 1] = '\0';
+    }
+    for (int i = 0; i < MEM_SUBSYSTEM_COUNT; i++) {
+        profiler->memory[i].phase_peak = profiler->memory[i].current;
+    }
+    profiler->memory_phase_peak = profiler->memory_total;
+    pthread_mutex_unlock(&profiler->profile_mutex);
+}
+
+// Keeps the tail idle time of a finished batch for the log, the first MAX_TAIL_PHASES of them
+void record_tail_idle(ProfilerData* profiler, const TailIdle* tail) {
+    pthread_mutex_lock(&profiler->profile_mutex);
+    if (profiler->tail_idle_count < MAX_TAIL_PHASES) {
+        profiler->tail_idle[profiler->tail_idle_count++] = *tail;
+    }
+    pthread_mutex_unlock(&profiler->profile_mutex);
+}
+
 void calculate_metrics(ProfilerData* profiler) {
     struct rusage current_usage;
     struct timeval current_time;
@@ -100,31 +325,45 @@ void calculate_metrics(ProfilerData* profiler) {
     profiler->last_usage = current_usage;
 }
 
+/*
+    Formats one sample of the performance log in memory under the profile mutex and hands it to
+    the async writer, the disk is never touched while the mutex is held (hotspots need it)
+*/
 void log_profile_data(ProfilerData* profiler) {
+    char* text = NULL;
+    size_t length = 0;
+    FILE* log_file = open_memstream(&text, &length);
+    if (log_file == NULL) {
+        return;
+    }
+
     pthread_mutex_lock(&profiler->profile_mutex);
-    FILE* log_file = fopen("performance_log.txt", "a");
-    if (log_file) {
-        fprintf(log_file, "Sample %d:\n", profiler->sample_count);
-        fprintf(log_file, "CPU Usage: %.2f%%\n", profiler->cpu_usage);
-        fprintf(log_file, "Memory Usage: %zu KB\n", profiler->memory_usage);
-        fprintf(log_file, "Wall Clock Time: %.6f seconds\n", profiler->wall_elapsed);
-        
-        // Log hotspots
-        fprintf(log_file, "Hotspots:\n");
-        for (int i = 0; i < MAX_HOTSPOTS; i++) {
-            if (profiler->hotspots[i].name[0] != '\0') {
-                fprintf(log_file, "  %s: Total Time=%.6f, Calls=%d, Avg Time=%.6f\n", 
-                    profiler->hotspots[i].name, 
-                    profiler->hotspots[i].total_time,
-                    profiler->hotspots[i].count,
-                    profiler->hotspots[i].total_time / (profiler->hotspots[i].count ? profiler->hotspots[i].count : 1)
-                );
-            }
+    fprintf(log_file, "Sample %d:\n", profiler->sample_count);
+    fprintf(log_file, "CPU Usage: %.2f%%\n", profiler->cpu_usage);
+    fprintf(log_file, "Memory Usage: %zu KB\n", profiler->memory_usage);
+    fprintf(log_file, "Wall Clock Time: %.6f seconds\n", profiler->wall_elapsed);
+    print_memory_accounting(profiler, log_file);
+    print_handoff_stats(profiler, log_file);
+    print_tail_idle(profiler, log_file);
+    
+    // Log hotspots
+    fprintf(log_file, "Hotspots:\n");
+    for (int i = 0; i < MAX_HOTSPOTS; i++) {
+        if (profiler->hotspots[i].name[0] != '\0') {
+            fprintf(log_file, "  %s: Total Time=%.6f, Calls=%d, Avg Time=%.6f\n", 
+                profiler->hotspots[i].name, 
+                profiler->hotspots[i].total_time,
+                profiler->hotspots[i].count,
+                profiler->hotspots[i].total_time / (profiler->hotspots[i].count ? profiler->hotspots[i].count : 1)
+            );
         }
-        fprintf(log_file, "------------------------\n");
-        fclose(log_file);
     }
+    fprintf(log_file, "------------------------\n");
     pthread_mutex_unlock(&profiler->profile_mutex);
+
+    fclose(log_file);
+    async_writer_append(PROFILE_LOG, text, length);
+    free(text);
 }
 
 void* profiling_thread(void* arg) {
@@ -134,7 +373,10 @@ void* profiling_thread(void* arg) {
     while (!buffer->all_data_processed) {
         calculate_metrics(profiler);
         log_profile_data(profiler);
-        usleep(10000000); // Sample every 10 seconds
+        // Sample every 10 seconds, but notice the end of the run within 100 ms
+        for (int i = 0; i < 100 && !buffer->all_data_processed; i++) {
+            usleep(100000);
+        }
     }
 
     // Final metrics
@@ -143,4 +385,343 @@ void* profiling_thread(void* arg) {
 
     pthread_mutex_destroy(&profiler->profile_mutex);
     return NULL;
-}
\ No newline at end of file
+}
+
+/*
+    SIGPROF handler: claims a sample slot and unwinds the interrupted thread into it.
+    No locks and no allocation; backtrace() was called once in sampler_start so libgcc
+    is already loaded when the first signal arrives.
+    CPU time timers are only checked on the scheduler tick, so above CONFIG_HZ several
+    periods expire at once and arrive as one signal; si_overrun tells how many, and the
+    sample is weighted with them to keep the profile proportional to CPU time
+*/
+static void sampler_signal(int sig, siginfo_t* info, void* context) {
+    (void)sig;
+    (void)context;
+    if (!sampler.enabled || sampler_thread < 0) {
+        return;
+    }
+
+    int saved_errno = errno;
+    long slot = __atomic_fetch_add(&sampler.next, 1, __ATOMIC_RELAXED);
+    if (slot < SAMPLER_MAX_SAMPLES) {
+        Sample* sample = &sampler.samples[slot];
+        sample->thread = sampler_thread;
+        sample->weight = 1 + (info->si_overrun > 0 ? info->si_overrun : 0);
+        sample->depth = backtrace(sample->frames, SAMPLER_MAX_FRAMES);
+    }
+    errno = saved_errno;
+}
+
+/*
+    Turns the sampling profiler on at `hz` samples per second of CPU time, per thread.
+    Threads take part after sampler_thread_start, the calling thread is registered as "main"
+*/
+int sampler_start(int hz) {
+    if (hz <= 0 || hz > 1000000) {
+        return 0;
+    }
+
+    sampler.samples = mmap(NULL, SAMPLER_MAX_SAMPLES * sizeof(Sample), PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (sampler.samples == MAP_FAILED) {
+        perror("sampler mmap() error");
+        sampler.samples = NULL;
+        return 0;
+    }
+
+    // A fresh run (--sweep starts one per configuration) begins with no samples and no threads
+    __atomic_store_n(&sampler.next, 0, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&sampler.threads_mutex);
+    sampler.thread_count = 0;
+    pthread_mutex_unlock(&sampler.threads_mutex);
+
+    void* warmup[4];
+    backtrace(warmup, 4);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = sampler_signal;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, NULL) != 0) {
+        perror("sigaction(SIGPROF) error");
+        return 0;
+    }
+
+    sampler.hz = hz;
+    sampler.enabled = 1;
+    sampler_thread_start("main");
+    return 1;
+}
+
+/*
+    Arms a timer on the CPU time of the calling thread that sends SIGPROF to this thread only,
+    so every thread is sampled at the same rate no matter how many threads are running
+*/
+void sampler_thread_start(const char* name) {
+    if (!sampler.enabled || sampler_thread >= 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&sampler.threads_mutex);
+    int thread = -1;
+    for (int i = 0; i < sampler.thread_count; i++) {
+        if (strcmp(sampler.threads[i], name) == 0) {
+            thread = i;
+            break;
+        }
+    }
+    if (thread < 0 && sampler.thread_count < SAMPLER_MAX_THREADS) {
+        thread = sampler.thread_count++;
+        strncpy(sampler.threads[thread], name, MAX_NAME_LENGTH - 1);
+    }
+    pthread_mutex_unlock(&sampler.threads_mutex);
+    if (thread < 0) {
+        return;
+    }
+
+    struct sigevent sev;
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGPROF;
+    sev.sigev_notify_thread_id = gettid();
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &sampler_timer) != 0) {
+        perror("timer_create() error");
+        return;
+    }
+
+    long period_ns = 1000000000L / sampler.hz;
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = period_ns / 1000000000L;
+    spec.it_interval.tv_nsec = period_ns % 1000000000L;
+    spec.it_value = spec.it_interval;
+    timer_settime(sampler_timer, 0, &spec, NULL);
+    sampler_thread = thread;
+}
+
+void sampler_thread_stop(void) {
+    if (sampler_thread < 0) {
+        return;
+    }
+    timer_delete(sampler_timer);
+    sampler_thread = -1;
+}
+
+typedef struct {
+    void* address;
+    char* symbol;
+} SymbolEntry;
+
+static int compare_symbol_entries(const void* a, const void* b) {
+    const SymbolEntry* x = a;
+    const SymbolEntry* y = b;
+    return (x->address > y->address) - (x->address < y->address);
+}
+
+typedef struct {
+    char* stack;  // "thread;root;...;leaf"
+    int weight;
+} FoldedStack;
+
+static int compare_stacks(const void* a, const void* b) {
+    return strcmp(((const FoldedStack*)a)->stack, ((const FoldedStack*)b)->stack);
+}
+
+// Frames after the interrupted one are return addresses, step back into the call instruction
+static void* frame_address(const Sample* sample, int frame) {
+    char* address = sample->frames[frame];
+    return frame > SAMPLER_SKIP_FRAMES ? address - 1 : address;
+}
+
+static const char* lookup_symbol(const SymbolEntry* symbols, int count, void* address) {
+    int low = 0, high = count - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (symbols[mid].address == address) {
+            return symbols[mid].symbol;
+        }
+        if (symbols[mid].address < address) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return "??";
+}
+
+/*
+    Names every distinct address. Addresses inside the executable go through addr2line in one
+    batch, so static functions get their real names; shared libraries use the dynamic symbol
+    dladdr finds. Runs at exit only, its cost does not count as sampling overhead
+*/
+static void symbolize(SymbolEntry* symbols, int count) {
+    Dl_info self;
+    char exe[1024];
+    ssize_t exe_len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    bool have_self = dladdr((void*)symbolize, &self) != 0 && exe_len > 0;
+    if (exe_len > 0) {
+        exe[exe_len] = '\0';
+    }
+
+    // addr2line wants file offsets for a PIE and absolute addresses otherwise
+    bool pie = true;
+    FILE* elf = have_self ? fopen(exe, "rb") : NULL;
+    if (elf != NULL) {
+        Elf64_Ehdr header;
+        if (fread(&header, sizeof(header), 1, elf) == 1) {
+            pie = header.e_type == ET_DYN;
+        }
+        fclose(elf);
+    }
+
+    char list_path[] = "/tmp/sampler_addrXXXXXX";
+    int list_fd = have_self ? mkstemp(list_path) : -1;
+    FILE* list = list_fd >= 0 ? fdopen(list_fd, "w") : NULL;
+    int* pending = malloc((count + 1) * sizeof(int));
+    int pending_count = 0;
+
+    for (int i = 0; i < count; i++) {
+        Dl_info info;
+        char name[256];
+        if (dladdr(symbols[i].address, &info) == 0) {
+            snprintf(name, sizeof(name), "%p", symbols[i].address);
+        } else if (list != NULL && info.dli_fbase == self.dli_fbase) {
+            uintptr_t address = (uintptr_t)symbols[i].address - (pie ? (uintptr_t)self.dli_fbase : 0);
+            fprintf(list, "%#lx\n", (unsigned long)address);
+            pending[pending_count++] = i;
+            continue;
+        } else if (info.dli_sname != NULL) {
+            snprintf(name, sizeof(name), "%s", info.dli_sname);
+        } else {
+            const char* library = strrchr(info.dli_fname, '/');
+            snprintf(name, sizeof(name), "%s+%#lx", library ? library + 1 : info.dli_fname,
+                     (unsigned long)((char*)symbols[i].address - (char*)info.dli_fbase));
+        }
+        symbols[i].symbol = strdup(name);
+    }
+
+    if (list != NULL) {
+        fclose(list);
+        char command[2200];
+        snprintf(command, sizeof(command), "addr2line -f -e '%s' < %s 2>/dev/null", exe, list_path);
+        FILE* out = pending_count > 0 ? popen(command, "r") : NULL;
+        char function[512], location[1024];
+        for (int i = 0; i < pending_count; i++) {
+            SymbolEntry* entry = &symbols[pending[i]];
+            if (out != NULL && fgets(function, sizeof(function), out) && fgets(location, sizeof(location), out)) {
+                function[strcspn(function, "\n")] = '\0';
+                if (strcmp(function, "??") != 0) {
+                    entry->symbol = strdup(function);
+                    continue;
+                }
+            }
+            snprintf(function, sizeof(function), "%p", entry->address);
+            entry->symbol = strdup(function);
+        }
+        if (out != NULL) {
+            pclose(out);
+        }
+        unlink(list_path);
+    }
+    free(pending);
+}
+
+/*
+    Stops sampling and writes the samples as folded stacks ("thread;root;...;leaf count" per
+    line), the input format of flamegraph.pl and speedscope. Call after the sampled threads
+    were joined
+*/
+void sampler_write(const char* path) {
+    if (sampler.samples == NULL) {
+        return;
+    }
+    sampler_thread_stop();
+    sampler.enabled = 0;
+
+    long taken = __atomic_load_n(&sampler.next, __ATOMIC_RELAXED);
+    long count = taken < SAMPLER_MAX_SAMPLES ? taken : SAMPLER_MAX_SAMPLES;
+
+    // Distinct addresses, symbolized once each
+    long address_count = 0;
+    for (long i = 0; i < count; i++) {
+        if (sampler.samples[i].depth > SAMPLER_SKIP_FRAMES) {
+            address_count += sampler.samples[i].depth - SAMPLER_SKIP_FRAMES;
+        }
+    }
+    SymbolEntry* symbols = malloc((address_count + 1) * sizeof(SymbolEntry));
+    int symbol_count = 0;
+    for (long i = 0; i < count; i++) {
+        for (int f = SAMPLER_SKIP_FRAMES; f < sampler.samples[i].depth; f++) {
+            symbols[symbol_count].address = frame_address(&sampler.samples[i], f);
+            symbols[symbol_count].symbol = NULL;
+            symbol_count++;
+        }
+    }
+    qsort(symbols, symbol_count, sizeof(SymbolEntry), compare_symbol_entries);
+    int unique = 0;
+    for (int i = 0; i < symbol_count; i++) {
+        if (unique == 0 || symbols[unique - 1].address != symbols[i].address) {
+            symbols[unique++] = symbols[i];
+        }
+    }
+    symbolize(symbols, unique);
+
+    // One string per sample, identical stacks end up next to each other after sorting
+    FoldedStack* stacks = malloc((count + 1) * sizeof(FoldedStack));
+    long stack_count = 0;
+    long periods = 0;
+    for (long i = 0; i < count; i++) {
+        Sample* sample = &sampler.samples[i];
+        if (sample->depth <= SAMPLER_SKIP_FRAMES) {
+            continue;
+        }
+        size_t capacity = 256, len = 0;
+        char* stack = malloc(capacity);
+        len = snprintf(stack, capacity, "%s", sampler.threads[sample->thread]);
+        periods += sample->weight;
+        for (int f = sample->depth - 1; f >= SAMPLER_SKIP_FRAMES; f--) {
+            const char* symbol = lookup_symbol(symbols, unique, frame_address(sample, f));
+            size_t needed = len + strlen(symbol) + 2;
+            if (needed > capacity) {
+                capacity = needed * 2;
+                stack = realloc(stack, capacity);
+            }
+            len += snprintf(stack + len, capacity - len, ";%s", symbol);
+        }
+        stacks[stack_count].stack = stack;
+        stacks[stack_count].weight = sample->weight;
+        stack_count++;
+    }
+    qsort(stacks, stack_count, sizeof(FoldedStack), compare_stacks);
+
+    FILE* file = fopen(path, "w");
+    if (file != NULL) {
+        for (long i = 0; i < stack_count; ) {
+            long j = i;
+            long weight = 0;
+            while (j < stack_count && compare_stacks(&stacks[i], &stacks[j]) == 0) {
+                weight += stacks[j].weight;
+                j++;
+            }
+            fprintf(file, "%s %ld\n", stacks[i].stack, weight);
+            i = j;
+        }
+        fclose(file);
+        printf("Sampling profiler: %ld samples (%ld periods of CPU time) at %d Hz (%ld dropped) written to %s\n",
+               count, periods, sampler.hz, taken - count, path);
+    } else {
+        printf("Error opening sampling profile: %s\n", path);
+    }
+
+    for (long i = 0; i < stack_count; i++) {
+        free(stacks[i].stack);
+    }
+    free(stacks);
+    for (int i = 0; i < unique; i++) {
+        free(symbols[i].symbol);
+    }
+    free(symbols);
+    munmap(sampler.samples, SAMPLER_MAX_SAMPLES * sizeof(Sample));
+    sampler.samples = NULL;
+}
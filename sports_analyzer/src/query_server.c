@@ -0,0 +1,525 @@
+#define _GNU_SOURCE // pthread_rwlockattr_setkind_np
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../include/query_server.h"
+#include "../include/utils.h"
+
+typedef struct {
+    char* data;
+    size_t len;
+    size_t capacity;
+} Reply;
+
+typedef struct {
+    int index;
+    double value;
+} RankEntry;
+
+typedef struct {
+    QueryServer* server;
+    int fd;
+} ClientArgs;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop_signal(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+static void reply_printf(Reply* reply, const char* format, ...) {
+    va_list args;
+    for (;;) {
+        size_t room = reply->capacity - reply->len;
+        va_start(args, format);
+        int n = vsnprintf(reply->data + reply->len, room, format, args);
+        va_end(args);
+        if (n < 0) {
+            return;
+        }
+        if ((size_t)n < room) {
+            reply->len += n;
+            return;
+        }
+        reply->capacity = reply->capacity * 2 + n;
+        reply->data = realloc(reply->data, reply->capacity);
+    }
+}
+
+static int write_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        data += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static unsigned int hash_name(const char* first, const char* last) {
+    unsigned int hash = 2166136261u; // FNV-1a over "first last", lower case
+    for (const char* p = first; *p; p++) {
+        hash = (hash ^ (unsigned char)tolower((unsigned char)*p)) * 16777619u;
+    }
+    hash = (hash ^ ' ') * 16777619u;
+    for (const char* p = last; *p; p++) {
+        hash = (hash ^ (unsigned char)tolower((unsigned char)*p)) * 16777619u;
+    }
+    return hash;
+}
+
+static double average_points(const Player* player) {
+    return player->tourneyz_count ? (double)player->points / player->tourneyz_count : 0.0;
+}
+
+static double average_ppa(const Player* player) {
+    return player->tourneyz_count ? ppa_value(player->ppa) / player->tourneyz_count : 0.0;
+}
+
+// Best value first, ties keep the player table order (same order as the reports)
+static int compare_rank_entries(const void* a, const void* b) {
+    const RankEntry* x = a;
+    const RankEntry* y = b;
+    if (x->value != y->value) {
+        return x->value < y->value ? 1 : -1;
+    }
+    return x->index - y->index;
+}
+
+static int* build_ranking(SportIndex* index, ProfilerData* profiler, bool by_ppa, int* count) {
+    *count = 0;
+    size_t bytes = (index->player_count + 1) * sizeof(int);
+    if (!memory_reserve(profiler, MEM_QUERY_SERVER, bytes, true)) {
+        return NULL; // degraded, TOP answers with an empty ranking
+    }
+
+    RankEntry* entries = malloc((index->player_count + 1) * sizeof(RankEntry));
+    int n = 0;
+    for (int i = 0; i < index->player_count; i++) {
+        const Player* player = &index->players[i];
+        if (player->tourneyz_count == 0 || (by_ppa && player->ppa == 0)) {
+            continue;
+        }
+        entries[n].index = i;
+        entries[n].value = by_ppa ? average_ppa(player) : average_points(player);
+        n++;
+    }
+    qsort(entries, n, sizeof(RankEntry), compare_rank_entries);
+
+    int* ranking = arena_alloc(&index->arena, bytes);
+    for (int i = 0; ranking != NULL && i < n; i++) {
+        ranking[i] = entries[i].index;
+    }
+    free(entries);
+    *count = ranking != NULL ? n : 0;
+    return ranking;
+}
+
+/*
+    Takes over the state of a finished sport (arena, player table, id index) and builds the
+    query indexes on top of it. The sport state is left empty, so the next load maps a new arena
+    instead of resetting the one the server now owns. Must be called with buffer->mutex held
+*/
+void query_server_publish_phase(QueryServer* server, SharedBuffer* buffer, int sport) {
+    SportState* state = &buffer->sports[sport];
+    SportIndex index;
+    memset(&index, 0, sizeof(index));
+    index.arena = state->arena;
+    index.players = state->players;
+    index.player_count = state->player_count;
+    index.player_index = state->player_index;
+    index.player_index_mask = state->player_index_mask;
+    index.date_index = state->date_index;
+
+    // The sport memory stays allocated, it just belongs to the server now
+    for (int i = 0; i < MEM_SUBSYSTEM_COUNT; i++) {
+        memory_transfer(&buffer->profiler, i, MEM_QUERY_SERVER, state->arena_bytes[i]);
+        state->arena_bytes[i] = 0;
+    }
+    memory_transfer(&buffer->profiler, MEM_DATE_INDEX, MEM_QUERY_SERVER, state->date_index.bytes);
+
+    memset(&state->arena, 0, sizeof(Arena));
+    memset(&state->ranking_log, 0, sizeof(RankingLog));
+    memset(&state->date_index, 0, sizeof(DateIndex));
+    state->players = NULL;
+    state->player_index = NULL;
+    state->player_index_mask = 0;
+    state->player_capacity = 0;
+    state->player_count = 0;
+
+    // Names are hashed into the same kind of open addressing table as the ids
+    unsigned int size = 1;
+    while (size < 2u * (unsigned int)(index.player_count + 1)) {
+        size <<= 1;
+    }
+    if (memory_reserve(&buffer->profiler, MEM_QUERY_SERVER, size * sizeof(int), true)) {
+        index.name_index = arena_alloc(&index.arena, size * sizeof(int));
+    }
+    index.name_index_mask = size - 1;
+    for (int i = 0; index.name_index != NULL && i < index.player_count; i++) {
+        unsigned int slot = hash_name(index.players[i].name_first, index.players[i].name_last) & index.name_index_mask;
+        while (index.name_index[slot] != 0) {
+            slot = (slot + 1) & index.name_index_mask;
+        }
+        index.name_index[slot] = i + 1;
+    }
+
+    index.by_ppa = build_ranking(&index, &buffer->profiler, true, &index.by_ppa_count);
+    index.by_points = build_ranking(&index, &buffer->profiler, false, &index.by_points_count);
+    index.ready = true;
+
+    pthread_rwlock_wrlock(&server->lock);
+    server->sports[sport] = index;
+    pthread_rwlock_unlock(&server->lock);
+
+    printf("Query server: %s indexes ready (%d players)\n", sport_descriptors[sport].name, index.player_count);
+}
+
+static int find_player_by_name(const SportIndex* index, const char* first, const char* last) {
+    if (index->name_index == NULL) {
+        return -1;
+    }
+    unsigned int slot = hash_name(first, last) & index->name_index_mask;
+    while (index->name_index[slot] != 0) {
+        const Player* player = &index->players[index->name_index[slot] - 1];
+        if (strcasecmp(player->name_first, first) == 0 && strcasecmp(player->name_last, last) == 0) {
+            return index->name_index[slot] - 1;
+        }
+        slot = (slot + 1) & index->name_index_mask;
+    }
+    return -1;
+}
+
+static void reply_player(Reply* reply, const Player* player) {
+    reply_printf(reply, "%d %s %s points=%d tournaments=%d avg_points=%.2f avg_ppa=%.4f\n",
+                 player->player_id, player->name_first, player->name_last, player->points,
+                 player->tourneyz_count, average_points(player), average_ppa(player));
+}
+
+static const SportIndex* sport_index(QueryServer* server, const char* sport, Reply* reply) {
+    int id = sport_by_name(sport);
+    if (id < 0) {
+        reply_printf(reply, "ERR unknown sport\n");
+        return NULL;
+    }
+    if (!server->sports[id].ready) {
+        reply_printf(reply, "ERR %s is not loaded yet\n", sport);
+        return NULL;
+    }
+    return &server->sports[id];
+}
+
+/*
+    Answers one query line. Every answer ends with a line "END" (or is a single "ERR ..." line)
+        TOP <sport> <ppa|points> [k]
+        PLAYER <sport> ID <player_id>
+        PLAYER <sport> NAME <first> <last>
+        POINTS <sport> <player_id>         average points per tournament
+        RANGE <sport> <player_id> <from> <to>   same between two dates (YYYYMMDD, month granularity)
+        PING
+    Runs under the read lock, only in-memory indexes are used
+*/
+static void answer_query(QueryServer* server, char* line, Reply* reply) {
+    char* save = NULL;
+    char* command = strtok_r(line, " \t\r", &save);
+    if (command == NULL) {
+        return;
+    }
+    if (strcasecmp(command, "PING") == 0) {
+        reply_printf(reply, "PONG\nEND\n");
+        return;
+    }
+
+    char* sport = strtok_r(NULL, " \t\r", &save);
+    const SportIndex* index = sport_index(server, sport, reply);
+    if (index == NULL) {
+        return;
+    }
+
+    if (strcasecmp(command, "TOP") == 0) {
+        char* metric = strtok_r(NULL, " \t\r", &save);
+        char* k_str = strtok_r(NULL, " \t\r", &save);
+        int k = k_str ? atoi(k_str) : QUERY_DEFAULT_TOP_K;
+        if (k < 1 || k > QUERY_MAX_TOP_K) {
+            reply_printf(reply, "ERR k must be between 1 and %d\n", QUERY_MAX_TOP_K);
+            return;
+        }
+
+        bool by_ppa;
+        if (metric != NULL && strcasecmp(metric, "ppa") == 0) {
+            by_ppa = true;
+        } else if (metric != NULL && strcasecmp(metric, "points") == 0) {
+            by_ppa = false;
+        } else {
+            reply_printf(reply, "ERR metric must be ppa or points\n");
+            return;
+        }
+
+        const int* ranking = by_ppa ? index->by_ppa : index->by_points;
+        int count = by_ppa ? index->by_ppa_count : index->by_points_count;
+        for (int i = 0; i < k && i < count; i++) {
+            const Player* player = &index->players[ranking[i]];
+            reply_printf(reply, "%d. %d %s %s %.4f (%d tournaments)\n", i + 1, player->player_id,
+                         player->name_first, player->name_last,
+                         by_ppa ? average_ppa(player) : average_points(player), player->tourneyz_count);
+        }
+        reply_printf(reply, "END\n");
+    } else if (strcasecmp(command, "PLAYER") == 0) {
+        char* key = strtok_r(NULL, " \t\r", &save);
+        int found = -1;
+        if (key != NULL && strcasecmp(key, "ID") == 0) {
+            char* id = strtok_r(NULL, " \t\r", &save);
+            if (id != NULL) {
+                found = lookup_player_id(index->player_index, index->player_index_mask, index->players, atoi(id));
+            }
+        } else if (key != NULL && strcasecmp(key, "NAME") == 0) {
+            char* first = strtok_r(NULL, " \t\r", &save);
+            char* last = strtok_r(NULL, " \t\r", &save);
+            if (first != NULL && last != NULL) {
+                found = find_player_by_name(index, first, last);
+            }
+        } else {
+            reply_printf(reply, "ERR usage: PLAYER <sport> ID <id> | PLAYER <sport> NAME <first> <last>\n");
+            return;
+        }
+        if (found < 0) {
+            reply_printf(reply, "ERR player not found\n");
+            return;
+        }
+        reply_player(reply, &index->players[found]);
+        reply_printf(reply, "END\n");
+    } else if (strcasecmp(command, "POINTS") == 0) {
+        char* id = strtok_r(NULL, " \t\r", &save);
+        int found = id ? lookup_player_id(index->player_index, index->player_index_mask, index->players, atoi(id)) : -1;
+        if (found < 0) {
+            reply_printf(reply, "ERR player not found\n");
+            return;
+        }
+        const Player* player = &index->players[found];
+        reply_printf(reply, "%d %s %s avg_points_per_tournament=%.2f points=%d tournaments=%d\nEND\n",
+                     player->player_id, player->name_first, player->name_last,
+                     average_points(player), player->points, player->tourneyz_count);
+    } else if (strcasecmp(command, "RANGE") == 0) {
+        char* id = strtok_r(NULL, " \t\r", &save);
+        char* from = strtok_r(NULL, " \t\r", &save);
+        char* to = strtok_r(NULL, " \t\r", &save);
+        if (id == NULL || from == NULL || to == NULL) {
+            reply_printf(reply, "ERR usage: RANGE <sport> <player_id> <from YYYYMMDD> <to YYYYMMDD>\n");
+            return;
+        }
+        int found = lookup_player_id(index->player_index, index->player_index_mask, index->players, atoi(id));
+        long long points;
+        int tourneys;
+        if (found < 0 || !date_index_range(&index->date_index, found, atoi(from), atoi(to), &points, &tourneys)) {
+            reply_printf(reply, "ERR player not found\n");
+            return;
+        }
+        const Player* player = &index->players[found];
+        reply_printf(reply, "%d %s %s avg_points_per_tournament=%.2f points=%lld tournaments=%d\nEND\n",
+                     player->player_id, player->name_first, player->name_last,
+                     tourneys ? (double)points / tourneys : 0.0, points, tourneys);
+    } else {
+        reply_printf(reply, "ERR unknown command\n");
+    }
+}
+
+static void* client_thread(void* arg) {
+    ClientArgs* args = (ClientArgs*)arg;
+    QueryServer* server = args->server;
+    int fd = args->fd;
+    free(args);
+    sampler_thread_start("query_client");
+
+    char input[QUERY_MAX_LINE * 4];
+    size_t len = 0;
+    Reply reply = { malloc(4096), 0, 4096 };
+
+    while (!stop_requested) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+        if (poll(&pfd, 1, 500) <= 0) {
+            continue;
+        }
+        ssize_t n = read(fd, input + len, sizeof(input) - 1 - len);
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+
+        // Answer every complete line, keep the rest for the next read
+        char* start = input;
+        char* newline;
+        while ((newline = memchr(start, '\n', input + len - start)) != NULL) {
+            *newline = '\0';
+
+            struct timespec t0, t1;
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            pthread_rwlock_rdlock(&server->lock);
+            answer_query(server, start, &reply);
+            pthread_rwlock_unlock(&server->lock);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+
+            __atomic_fetch_add(&server->queries, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&server->query_ns,
+                               (unsigned long)((t1.tv_sec - t0.tv_sec) * 1000000000L + (t1.tv_nsec - t0.tv_nsec)),
+                               __ATOMIC_RELAXED);
+            start = newline + 1;
+        }
+        len = input + len - start;
+        memmove(input, start, len);
+        if (len == sizeof(input) - 1) {
+            reply_printf(&reply, "ERR line too long\n");
+            len = 0;
+        }
+
+        if (reply.len > 0) {
+            if (!write_all(fd, reply.data, reply.len)) {
+                break;
+            }
+            reply.len = 0;
+        }
+    }
+
+    free(reply.data);
+    close(fd);
+
+    pthread_mutex_lock(&server->clients_mutex);
+    server->active_clients--;
+    pthread_cond_signal(&server->clients_done);
+    pthread_mutex_unlock(&server->clients_mutex);
+    sampler_thread_stop();
+    return NULL;
+}
+
+/*
+    Accepts clients until SIGINT/SIGTERM, every client gets its own detached thread
+*/
+static void* accept_thread(void* arg) {
+    QueryServer* server = (QueryServer*)arg;
+
+    while (!stop_requested) {
+        struct pollfd pfd = { .fd = server->listen_fd, .events = POLLIN, .revents = 0 };
+        if (poll(&pfd, 1, 500) <= 0) {
+            continue;
+        }
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+
+        ClientArgs* args = malloc(sizeof(ClientArgs));
+        args->server = server;
+        args->fd = fd;
+
+        pthread_mutex_lock(&server->clients_mutex);
+        server->active_clients++;
+        pthread_mutex_unlock(&server->clients_mutex);
+
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attr, client_thread, args) != 0) {
+            close(fd);
+            free(args);
+            pthread_mutex_lock(&server->clients_mutex);
+            server->active_clients--;
+            pthread_mutex_unlock(&server->clients_mutex);
+        }
+        pthread_attr_destroy(&attr);
+    }
+    return NULL;
+}
+
+/*
+    Binds the Unix socket and starts accepting clients right away, queries for a sport
+    are answered as soon as its phase is published
+*/
+int query_server_start(QueryServer* server, const char* socket_path) {
+    memset(server, 0, sizeof(QueryServer));
+    strncpy(server->socket_path, socket_path, sizeof(server->socket_path) - 1);
+
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_READER_NP);
+    pthread_rwlock_init(&server->lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    pthread_mutex_init(&server->clients_mutex, NULL);
+    pthread_cond_init(&server->clients_done, NULL);
+
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server->listen_fd < 0) {
+        perror("socket() error");
+        return 0;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, server->socket_path, sizeof(addr.sun_path) - 1); // socket_path is terminated, addr was zeroed
+    unlink(server->socket_path);
+
+    if (bind(server->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(server->listen_fd, SOMAXCONN) != 0) {
+        perror("bind()/listen() error");
+        close(server->listen_fd);
+        return 0;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN); // a client going away must not kill the server
+
+    pthread_create(&server->accept_thread, NULL, accept_thread, server);
+    printf("Query server listening on %s\n", server->socket_path);
+    return 1;
+}
+
+/*
+    Blocks until the server is stopped (SIGINT/SIGTERM) and every client is gone,
+    then frees the published phases
+*/
+void query_server_wait(QueryServer* server) {
+    printf("Query server: all phases loaded, serving queries (Ctrl+C to stop)\n");
+    fflush(stdout);
+
+    pthread_join(server->accept_thread, NULL);
+    close(server->listen_fd);
+    unlink(server->socket_path);
+
+    pthread_mutex_lock(&server->clients_mutex);
+    while (server->active_clients > 0) {
+        pthread_cond_wait(&server->clients_done, &server->clients_mutex);
+    }
+    pthread_mutex_unlock(&server->clients_mutex);
+
+    unsigned long queries = server->queries;
+    printf("Query server: %lu queries, avg latency %.2f us\n", queries,
+           queries ? server->query_ns / 1000.0 / queries : 0.0);
+
+    for (int i = 0; i < SPORT_COUNT; i++) {
+        arena_release(&server->sports[i].arena);
+        free_date_index(&server->sports[i].date_index);
+    }
+    pthread_rwlock_destroy(&server->lock);
+    pthread_mutex_destroy(&server->clients_mutex);
+    pthread_cond_destroy(&server->clients_done);
+}
@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include "../include/scheduler.h"
+
+static long long now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+bool scheduler_init(TaskScheduler* scheduler, int workers) {
+    memset(scheduler, 0, sizeof(*scheduler));
+    scheduler->workers = workers;
+    scheduler->queue_limit = STEAL_TASKS_PER_WORKER * workers;
+    scheduler->deques = calloc((size_t)workers, sizeof(TaskDeque));
+    scheduler->busy_until = calloc((size_t)workers, sizeof(long long));
+    if (scheduler->deques == NULL || scheduler->busy_until == NULL) {
+        free(scheduler->deques);
+        free(scheduler->busy_until);
+        return false;
+    }
+    // A deque never holds more than everything that may be queued
+    for (int i = 0; i < workers; i++) {
+        TaskDeque* deque = &scheduler->deques[i];
+        deque->capacity = scheduler->queue_limit;
+        deque->tasks = malloc((size_t)deque->capacity * sizeof(ChunkTask));
+        pthread_mutex_init(&deque->mutex, NULL);
+    }
+    pthread_mutex_init(&scheduler->mutex, NULL);
+    pthread_cond_init(&scheduler->work, NULL);
+    pthread_cond_init(&scheduler->room, NULL);
+    scheduler_open(scheduler);
+    return true;
+}
+
+void scheduler_destroy(TaskScheduler* scheduler) {
+    for (int i = 0; i < scheduler->workers; i++) {
+        free(scheduler->deques[i].tasks);
+        pthread_mutex_destroy(&scheduler->deques[i].mutex);
+    }
+    free(scheduler->deques);
+    free(scheduler->busy_until);
+    pthread_mutex_destroy(&scheduler->mutex);
+    pthread_cond_destroy(&scheduler->work);
+    pthread_cond_destroy(&scheduler->room);
+}
+
+// Starts a batch: no task is queued yet and every worker clock starts now
+void scheduler_open(TaskScheduler* scheduler) {
+    pthread_mutex_lock(&scheduler->mutex);
+    scheduler->closed = false;
+    scheduler->tasks = 0;
+    scheduler->steals = 0;
+    scheduler->batch_start = now_ns();
+    for (int i = 0; i < scheduler->workers; i++) {
+        scheduler->busy_until[i] = scheduler->batch_start;
+    }
+    pthread_mutex_unlock(&scheduler->mutex);
+}
+
+static void push_newest(TaskDeque* deque, const ChunkTask* task) {
+    pthread_mutex_lock(&deque->mutex);
+    deque->tasks[(deque->head + deque->count) % deque->capacity] = *task;
+    deque->count++;
+    pthread_mutex_unlock(&deque->mutex);
+}
+
+static bool pop_newest(TaskDeque* deque, ChunkTask* task) {
+    bool found = false;
+    pthread_mutex_lock(&deque->mutex);
+    if (deque->count > 0) {
+        deque->count--;
+        *task = deque->tasks[(deque->head + deque->count) % deque->capacity];
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->mutex);
+    return found;
+}
+
+static bool steal_oldest(TaskDeque* deque, ChunkTask* task) {
+    bool found = false;
+    pthread_mutex_lock(&deque->mutex);
+    if (deque->count > 0) {
+        *task = deque->tasks[deque->head];
+        deque->head = (deque->head + 1) % deque->capacity;
+        deque->count--;
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->mutex);
+    return found;
+}
+
+/*
+    Queues a task on the next worker in turn, waiting while queue_limit tasks are queued.
+    The slot is counted before the task is pushed, so queued never falls below the number
+    of tasks in the deques and a worker never misses a task it could take
+*/
+void scheduler_submit(TaskScheduler* scheduler, const ChunkTask* task) {
+    pthread_mutex_lock(&scheduler->mutex);
+    while (scheduler->queued >= scheduler->queue_limit) {
+        scheduler->producer_waiting = true;
+        pthread_cond_wait(&scheduler->room, &scheduler->mutex);
+    }
+    scheduler->producer_waiting = false;
+    scheduler->queued++;
+    int deque = scheduler->next_deque;
+    scheduler->next_deque = (deque + 1) % scheduler->workers;
+    pthread_mutex_unlock(&scheduler->mutex);
+
+    push_newest(&scheduler->deques[deque], task);
+    pthread_cond_signal(&scheduler->work);
+}
+
+// Every task of the batch is queued, workers return from scheduler_take once they are all taken
+void scheduler_close(TaskScheduler* scheduler) {
+    pthread_mutex_lock(&scheduler->mutex);
+    scheduler->closed = true;
+    pthread_cond_broadcast(&scheduler->work);
+    pthread_mutex_unlock(&scheduler->mutex);
+}
+
+/*
+    Takes the next task of a worker: its own newest task, otherwise the oldest task of another
+    worker, the victims are tried starting at a random one so thieves do not pile up on the same
+    deque. Sleeps while nothing is queued, returns false when the batch is closed and drained
+*/
+bool scheduler_take(TaskScheduler* scheduler, int worker, unsigned int* seed, ChunkTask* task) {
+    for (;;) {
+        bool stolen = false;
+        bool found = pop_newest(&scheduler->deques[worker], task);
+        if (!found && scheduler->workers > 1) {
+            int victim = rand_r(seed) % scheduler->workers;
+            for (int i = 0; i < scheduler->workers && !found; i++) {
+                int other = (victim + i) % scheduler->workers;
+                if (other != worker) {
+                    found = stolen = steal_oldest(&scheduler->deques[other], task);
+                }
+            }
+        }
+
+        pthread_mutex_lock(&scheduler->mutex);
+        if (found) {
+            scheduler->queued--;
+            scheduler->tasks++;
+            scheduler->steals += stolen;
+            if (scheduler->producer_waiting) {
+                pthread_cond_signal(&scheduler->room);
+            }
+            pthread_mutex_unlock(&scheduler->mutex);
+            return true;
+        }
+        if (scheduler->queued == 0 && scheduler->closed) {
+            pthread_mutex_unlock(&scheduler->mutex);
+            return false;
+        }
+        bool pushing = scheduler->queued > 0; // counted, but the producer has not pushed it yet
+        while (scheduler->queued == 0 && !scheduler->closed) {
+            pthread_cond_wait(&scheduler->work, &scheduler->mutex);
+        }
+        pthread_mutex_unlock(&scheduler->mutex);
+        if (pushing) {
+            sched_yield();
+        }
+    }
+}
+
+// The worker did some work just now, only the worker itself writes its clock
+void scheduler_mark_busy(TaskScheduler* scheduler, int worker) {
+    scheduler->busy_until[worker] = now_ns();
+}
+
+/*
+    Idle time at the tail of the batch that just finished: the batch ends when the last worker
+    finishes its last piece of work, every other worker idled from the end of its own last piece
+    until then. Called once every worker is done with the batch
+*/
+void scheduler_tail_idle(TaskScheduler* scheduler, const char* name, TailIdle* tail) {
+    long long end = scheduler->batch_start;
+    for (int i = 0; i < scheduler->workers; i++) {
+        end = scheduler->busy_until[i] > end ? scheduler->busy_until[i] : end;
+    }
+
+    memset(tail, 0, sizeof(*tail));
+    snprintf(tail->name, sizeof(tail->name), "%s", name != NULL ? name : "");
+    tail->workers = scheduler->workers;
+    tail->span = (end - scheduler->batch_start) / 1e9;
+    for (int i = 0; i < scheduler->workers; i++) {
+        double idle = (end - scheduler->busy_until[i]) / 1e9;
+        tail->idle_total += idle;
+        tail->idle_max = idle > tail->idle_max ? idle : tail->idle_max;
+    }
+    tail->tasks = scheduler->tasks;
+    tail->steals = scheduler->steals;
+}
@@ -0,0 +1,32 @@
+#include <string.h>
+#include <strings.h>
+#include "../include/sport.h"
+
+/*
+    Looks a sport up by its name (case insensitive), -1 if there is no such sport
+*/
+int sport_by_name(const char* name) {
+    for (int i = 0; name != NULL && i < SPORT_COUNT; i++) {
+        if (strcasecmp(sport_descriptors[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+    The sport a data file belongs to, from the data directory in its path (-1 if none).
+    Called once per file, the rows then carry the sport id through the buffer
+*/
+int sport_for_path(const char* path) {
+    for (int i = 0; i < SPORT_COUNT; i++) {
+        if (strstr(path, sport_descriptors[i].data_dir) != NULL) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool sport_is_ranking_file(int sport, const char* path) {
+    return strstr(path, sport_descriptors[sport].ranking_marker) != NULL;
+}
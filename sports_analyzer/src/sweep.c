@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "../include/sweep.h"
+#include "../include/engine.h"
+
+typedef struct {
+    int threads;
+    double mean;
+    double stddev;
+    double min;
+    int report_mismatches;  // runs whose reports differ from the serial warm-up run
+} SweepPoint;
+
+/*
+    FNV-1a over the reports of every sport. The aggregation is order independent (integer
+    points, fixed point PPA), so every run must produce exactly the reports of the serial run
+*/
+static unsigned long long fingerprint_reports(void) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (int i = 0; i < SPORT_COUNT; i++) {
+        FILE* report = fopen(sport_descriptors[i].report_file, "rb");
+        if (report == NULL) {
+            continue;
+        }
+        int c;
+        while ((c = fgetc(report)) != EOF) {
+            hash = (hash ^ (unsigned char)c) * 1099511628211ULL;
+        }
+        fclose(report);
+        hash = (hash ^ 0xff) * 1099511628211ULL; // report separator
+    }
+    return hash;
+}
+
+static void measure(const AnalyzerOptions* options, int threads, unsigned long long expected, SweepPoint* point) {
+    AnalyzerOptions run = *options;
+    run.threads = threads;
+    run.sweep_max = 0;
+
+    double sum = 0.0, sum_sq = 0.0;
+    point->threads = threads;
+    point->min = 0.0;
+    point->report_mismatches = 0;
+    for (int r = 0; r < options->sweep_repeat; r++) {
+        double elapsed = 0.0;
+        run_analyzer(&run, &elapsed);
+        sum += elapsed;
+        sum_sq += elapsed * elapsed;
+        if (r == 0 || elapsed < point->min) {
+            point->min = elapsed;
+        }
+        bool same = fingerprint_reports() == expected;
+        if (!same) {
+            point->report_mismatches++;
+        }
+        printf("Sweep: %d thread(s), run %d/%d: %.3f s%s\n", threads, r + 1, options->sweep_repeat, elapsed,
+               same ? "" : ", REPORTS DIFFER FROM THE SERIAL RUN");
+        fflush(stdout);
+    }
+
+    int n = options->sweep_repeat;
+    point->mean = sum / n;
+    // Sample standard deviation, 0 for a single run
+    point->stddev = n > 1 ? sqrt(fmax(0.0, (sum_sq - sum * sum / n) / (n - 1))) : 0.0;
+}
+
+/*
+    Runs the same engine on the same data with 1, 2, 4, ... sweep_max workers (sweep_max itself
+    is always included) and reports for every count
+        speedup     S(p) = T(1) / T(p)
+        efficiency  E(p) = S(p) / p
+        Karp-Flatt  e(p) = (1 / S(p) - 1 / p) / (1 - 1 / p), the experimentally determined
+                    serial fraction; if it grows with p the loss is overhead, not serial code
+    T is the mean over sweep_repeat runs. One untimed serial run first warms the page cache, its
+    reports are the reference every later run must reproduce byte for byte (the sweep fails otherwise)
+*/
+int run_sweep(const AnalyzerOptions* options) {
+    SweepPoint points[32];
+    int count = 0;
+    for (int threads = 1; count < 32; threads *= 2) {
+        int capped = threads < options->sweep_max ? threads : options->sweep_max;
+        points[count++].threads = capped;
+        if (capped == options->sweep_max) {
+            break;
+        }
+    }
+
+    AnalyzerOptions warmup = *options;
+    warmup.threads = 1;
+    warmup.sweep_max = 0;
+    printf("Sweep: warm-up run\n");
+    if (!run_analyzer(&warmup, NULL)) {
+        return 0;
+    }
+    unsigned long long expected = fingerprint_reports();
+
+    int mismatches = 0;
+    for (int i = 0; i < count; i++) {
+        measure(options, points[i].threads, expected, &points[i]);
+        mismatches += points[i].report_mismatches;
+    }
+
+    FILE* file = fopen(SWEEP_OUTPUT, "w");
+    FILE* outputs[2] = { stdout, file };
+    for (int o = 0; o < 2; o++) {
+        FILE* out = outputs[o];
+        if (out == NULL) {
+            continue;
+        }
+        fprintf(out, "\nSpeedup sweep, %d run(s) per thread count (time = mean +- stddev)\n", options->sweep_repeat);
+        fprintf(out, "%8s %10s %10s %10s %8s %10s %10s %11s %8s\n",
+                "threads", "time [s]", "stddev", "min [s]", "cv [%]", "speedup", "efficiency", "karp-flatt", "reports");
+        double base = points[0].mean;
+        for (int i = 0; i < count; i++) {
+            SweepPoint* point = &points[i];
+            double speedup = point->mean > 0.0 ? base / point->mean : 0.0;
+            double efficiency = speedup / point->threads;
+            double cv = point->mean > 0.0 ? 100.0 * point->stddev / point->mean : 0.0;
+            fprintf(out, "%8d %10.3f %10.3f %10.3f %8.1f %10.2f %10.2f ",
+                    point->threads, point->mean, point->stddev, point->min, cv, speedup, efficiency);
+            if (point->threads > 1 && speedup > 0.0) {
+                double p = point->threads;
+                fprintf(out, "%11.3f", (1.0 / speedup - 1.0 / p) / (1.0 - 1.0 / p));
+            } else {
+                fprintf(out, "%11s", "-");
+            }
+            fprintf(out, " %8s\n", point->report_mismatches == 0 ? "same" : "DIFFER");
+        }
+        if (mismatches > 0) {
+            fprintf(out, "%d run(s) produced reports that differ from the serial run\n", mismatches);
+        } else {
+            fprintf(out, "Reports identical to the serial run at every thread count\n");
+        }
+    }
+    if (file != NULL) {
+        fclose(file);
+        printf("Sweep results written to %s\n", SWEEP_OUTPUT);
+    }
+    return mismatches == 0;
+}
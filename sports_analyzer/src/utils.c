@@ -1,33 +1,69 @@
 #include <stdlib.h>
 #include "../include/utils.h"
+#include "../include/engine.h"
+#include "../include/sweep.h"
 #include <string.h>
 #include <stdio.h>
 
+// Rough per player footprint used to size a sport arena: the Player itself, both names,
+// two index slots and the first tourney set
+#define PLAYER_ARENA_ESTIMATE (sizeof(Player) + 64 + 2 * sizeof(int) + INITIAL_TOURNEYZ * sizeof(int))
+
+
+void init_options(AnalyzerOptions* options) {
+    options->watch_phase = PHASE_DONE;
+    options->serve_path = NULL;
+    options->range_from = 0;
+    options->range_to = 0;
+    options->memory_budget = 0;
+    options->budget_policy = BUDGET_ABORT;
+    options->sample_hz = 0;
+    options->threads = DEFAULT_WORKERS;
+    options->sweep_max = 0;
+    options->sweep_repeat = SWEEP_DEFAULT_REPEAT;
+    options->single_pass = false;
+    options->batch_min = HANDOFF_BATCH_MIN;
+    options->batch_max = HANDOFF_BATCH_MAX;
+    options->prefetch_window = PREFETCH_WINDOW;
+    options->prefetch_thread = false;
+    options->cold_cache = false;
+    options->schedule = SCHEDULE_STEAL;
+}
+
+// Name of a phase for the memory accounting, NULL once everything is done
+const char* phase_name(ProcessingPhase phase) {
+    if (phase < PHASE_ALL_SPORTS) {
+        return sport_descriptors[phase].name;
+    }
+    return phase == PHASE_ALL_SPORTS ? "all sports" : NULL;
+}
 
 void init_buffer(SharedBuffer* buffer, int size) {
     
     buffer->entries = (BufferEntry*)malloc(size * sizeof(BufferEntry));
 
-    buffer->players = (Player*)malloc(66000 * sizeof(Player));
-
-    memset(&buffer->player_with_max_points_tennis, 0, sizeof(Player));
-    memset(&buffer->player_with_max_points_football, 0, sizeof(Player));
+    // The player tables are allocated per sport from the sport arena, see prepare_sport_state
+    memset(buffer->sports, 0, sizeof(buffer->sports));
+    for (int i = 0; i < SPORT_COUNT; i++) {
+        pthread_mutex_init(&buffer->sports[i].mutex, NULL);
+    }
 
     buffer->size = size;
     buffer->in = 0;
     buffer->out = 0;
     buffer->count = 0;
-    buffer->player_count = 0; 
+    buffer->batch_size = 1;
     buffer->all_data_processed = false;
     buffer->active_consumers = 0;
-    buffer->debug_count = 0;
+    buffer->num_consumers = 0;
 
     buffer->current_phase = PHASE_FOOTBALL;
+    buffer->phase_generation = 0;
+    init_options(&buffer->options);
+    buffer->query_server = NULL;
     buffer->phase_data_processed = false;
     pthread_mutex_init(&buffer->phase_mutex, NULL);
     pthread_cond_init(&buffer->phase_change, NULL);
-    pthread_mutex_destroy(&buffer->phase_mutex);
-    pthread_cond_destroy(&buffer->phase_change);
 
     pthread_mutex_init(&buffer->mutex, NULL);
     pthread_mutex_init(&buffer->completion_mutex, NULL);
@@ -38,10 +74,82 @@ void init_buffer(SharedBuffer* buffer, int size) {
 
 }
 
+// Starts the handoff at the initial batch size, within the bounds of the options
+void init_handoff(SharedBuffer* buffer) {
+    int size = HANDOFF_BATCH_INITIAL;
+    size = size < buffer->options.batch_min ? buffer->options.batch_min : size;
+    size = size > buffer->options.batch_max ? buffer->options.batch_max : size;
+    buffer->batch_size = size;
+
+    HandoffStats* stats = &buffer->profiler.handoff;
+    stats->bound_min = buffer->options.batch_min;
+    stats->bound_max = buffer->options.batch_max;
+    stats->current = size;
+    stats->smallest = size;
+    stats->largest = size;
+}
+
+/*
+    Called by a consumer after every batch with the ring occupancy it found and the time the
+    batch took. Every HANDOFF_ADAPT_INTERVAL batches it moves the shared batch size:
+    a ring that stays over 3/4 full means the consumers are behind, bigger batches take fewer
+    locks; a ring under 1/4 means they wait for rows, smaller batches hand rows over sooner.
+    The size is also capped so one batch takes at most HANDOFF_TARGET_NS of a worker
+*/
+void adapt_batch_size(SharedBuffer* buffer, HandoffController* controller, int occupancy, int rows, long long service_ns) {
+    HandoffStats* stats = &buffer->profiler.handoff;
+    __atomic_fetch_add(&stats->batches, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->rows, (unsigned long)rows, __ATOMIC_RELAXED);
+    int bucket = 0;
+    while ((2 << bucket) <= rows && bucket < HANDOFF_HISTOGRAM_BUCKETS - 1) {
+        bucket++;
+    }
+    __atomic_fetch_add(&stats->histogram[bucket], 1, __ATOMIC_RELAXED);
+
+    // Exponentially weighted averages, the first batch starts them
+    double fill = (double)occupancy / buffer->size;
+    double row_ns = rows > 0 ? (double)service_ns / rows : controller->row_ns;
+    controller->fill = controller->batches ? 0.875 * controller->fill + 0.125 * fill : fill;
+    controller->row_ns = controller->batches ? 0.875 * controller->row_ns + 0.125 * row_ns : row_ns;
+    if (++controller->batches % HANDOFF_ADAPT_INTERVAL != 0) {
+        return;
+    }
+
+    int size = __atomic_load_n(&buffer->batch_size, __ATOMIC_RELAXED);
+    int next = size;
+    if (controller->fill > 0.75) {
+        next = size * 2;
+    } else if (controller->fill < 0.25) {
+        next = size / 2;
+    }
+    if (controller->row_ns > 0.0 && next > HANDOFF_TARGET_NS / controller->row_ns) {
+        next = (int)(HANDOFF_TARGET_NS / controller->row_ns);
+    }
+    next = next < buffer->options.batch_min ? buffer->options.batch_min : next;
+    next = next > buffer->options.batch_max ? buffer->options.batch_max : next;
+
+    // Another consumer may have moved it in the meantime, its decision wins then
+    if (next != size && __atomic_compare_exchange_n(&buffer->batch_size, &size, next, false,
+                                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&buffer->profiler.profile_mutex);
+        stats->current = next;
+        stats->adjustments++;
+        stats->smallest = next < stats->smallest ? next : stats->smallest;
+        stats->largest = next > stats->largest ? next : stats->largest;
+        pthread_mutex_unlock(&buffer->profiler.profile_mutex);
+    }
+}
+
 void destroy_buffer(SharedBuffer* buffer) {
     
     free(buffer->entries);
-    free(buffer->players);
+    for (int i = 0; i < SPORT_COUNT; i++) {
+        arena_release(&buffer->sports[i].arena);
+        free_date_index(&buffer->sports[i].date_index);
+        pthread_mutex_destroy(&buffer->sports[i].mutex);
+    }
+    pthread_mutex_destroy(&buffer->phase_mutex);
+    pthread_cond_destroy(&buffer->phase_change);
     pthread_mutex_destroy(&buffer->mutex);
     pthread_mutex_destroy(&buffer->completion_mutex);
     pthread_cond_destroy(&buffer->not_full);
@@ -52,42 +160,346 @@ void destroy_buffer(SharedBuffer* buffer) {
 
 
 
-void print_top_ppa_players(SharedBuffer* buffer, FILE* file, bool is_football) {
-    (void)is_football;
-    // Create temporary array of player pointers for sorting
-    Player** players = malloc(buffer->player_count * sizeof(Player*));
+typedef struct {
+    Player* player;
+    double avg_ppa;
+} RankedPlayer;
+
+// Highest average first, ties keep the player table order
+static int compare_ranked_players(const void* a, const void* b) {
+    const RankedPlayer* x = a;
+    const RankedPlayer* y = b;
+    if (x->avg_ppa != y->avg_ppa) {
+        return x->avg_ppa < y->avg_ppa ? 1 : -1;
+    }
+    return (x->player > y->player) - (x->player < y->player);
+}
+
+/*
+    Prints the top 10 players by average PPA per tournament
+    The averages are computed in a temporary array, the player table is left untouched so the
+    report can be generated again after more data came in (watch mode)
+*/
+void print_top_ppa_players(SharedBuffer* buffer, const SportState* state, FILE* file) {
+    // Create temporary array of players for sorting
+    size_t bytes = (state->player_count + 1) * sizeof(RankedPlayer);
+    memory_reserve(&buffer->profiler, MEM_REPORT_TEMP, bytes, false);
+    RankedPlayer* players = malloc(bytes);
     int valid_count = 0;
     
-    for (int i = 0; i < buffer->player_count; i++) {
-        if (buffer->players[i].ppa != 0 && buffer->players[i].tourneyz_count > 0) {
+    for (int i = 0; i < state->player_count; i++) {
+        if (state->players[i].ppa != 0 && state->players[i].tourneyz_count > 0) {
             // Calculate average PPA per tournament
-            buffer->players[i].ppa /= buffer->players[i].tourneyz_count;
-            players[valid_count] = &buffer->players[i];
+            players[valid_count].player = &state->players[i];
+            players[valid_count].avg_ppa = ppa_value(state->players[i].ppa) / state->players[i].tourneyz_count;
             valid_count++;
         }
     }
     
     // Sort players by average PPA
-    for (int i = 0; i < valid_count - 1; i++) {
-        for (int j = 0; j < valid_count - i - 1; j++) {
-            if (players[j]->ppa < players[j + 1]->ppa) {
-                Player* temp = players[j];
-                players[j] = players[j + 1];
-                players[j + 1] = temp;
-            }
-        }
-    }
+    qsort(players, valid_count, sizeof(RankedPlayer), compare_ranked_players);
     
     // Print top 10 (or less if fewer players)
     int limit = valid_count < 10 ? valid_count : 10;
     for (int i = 0; i < limit; i++) {
         fprintf(file, "%d. %s %s - Average PPA: %.4f (across %d tournaments)\n", 
                 i + 1, 
-                players[i]->name_first,
-                players[i]->name_last,
-                players[i]->ppa,
-                players[i]->tourneyz_count);
+                players[i].player->name_first,
+                players[i].player->name_last,
+                players[i].avg_ppa,
+                players[i].player->tourneyz_count);
     }
     
     free(players);
-}
\ No newline at end of file
+    memory_release(&buffer->profiler, MEM_REPORT_TEMP, bytes);
+}
+
+
+/*
+    Counts the data rows (header excluded) of a CSV file so the phase state can be sized
+    from the real player count instead of a hard coded maximum
+*/
+int count_csv_rows(const char* file_path) {
+    FILE* file = fopen(file_path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+
+    char chunk[1 << 16];
+    size_t n;
+    int lines = 0;
+    char last = '\n';
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        for (char* p = chunk; (p = memchr(p, '\n', chunk + n - p)) != NULL; p++) {
+            lines++;
+        }
+        last = chunk[n - 1];
+    }
+    fclose(file);
+
+    if (last != '\n') {
+        lines++; // last row without a trailing newline
+    }
+    return lines > 0 ? lines - 1 : 0;
+}
+
+static unsigned int hash_int(int key) {
+    return (unsigned int)key * 2654435761u;
+}
+
+/*
+    Arena allocation accounted to a subsystem. The bytes are remembered per subsystem in
+    arena_bytes, so they can be released from the accounting when the arena is reset
+*/
+static void* phase_alloc(SharedBuffer* buffer, SportState* state, MemorySubsystem subsystem, size_t size, bool optional) {
+    size = (size + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+    if (!memory_reserve(&buffer->profiler, subsystem, size, optional)) {
+        return NULL;
+    }
+    void* ptr = arena_alloc(&state->arena, size);
+    if (ptr == NULL) {
+        memory_release(&buffer->profiler, subsystem, size);
+        return NULL;
+    }
+    state->arena_bytes[subsystem] += size;
+    return ptr;
+}
+
+static char* phase_strdup(SharedBuffer* buffer, SportState* state, const char* str) {
+    size_t len = strlen(str) + 1;
+    char* copy = phase_alloc(buffer, state, MEM_PLAYER_TABLE, len, false);
+    if (copy != NULL) {
+        memcpy(copy, str, len);
+    }
+    return copy;
+}
+
+static void drop_date_index(SharedBuffer* buffer, SportState* state) {
+    memory_release(&buffer->profiler, MEM_DATE_INDEX, state->date_index.bytes);
+    free_date_index(&state->date_index);
+}
+
+// The arena is about to be reset (or was handed over), its bytes leave the accounting
+static void release_phase_memory(SharedBuffer* buffer, SportState* state) {
+    for (int i = 0; i < MEM_SUBSYSTEM_COUNT; i++) {
+        memory_release(&buffer->profiler, i, state->arena_bytes[i]);
+        state->arena_bytes[i] = 0;
+    }
+    memset(&state->ranking_log, 0, sizeof(RankingLog));
+    drop_date_index(buffer, state);
+}
+
+/*
+    Sets up the state of a sport (player table and player_id index) in its arena.
+    The arena is sized from the number of player rows, anything allocated later
+    (names, tourney sets) comes from the same arena
+*/
+int prepare_sport_state(SharedBuffer* buffer, SportState* state, int player_rows) {
+    if (player_rows < 1) {
+        player_rows = 1;
+    }
+
+    unsigned int index_size = 1;
+    while (index_size < 2u * (unsigned int)player_rows) {
+        index_size <<= 1;
+    }
+
+    size_t capacity = (size_t)player_rows * PLAYER_ARENA_ESTIMATE + index_size * sizeof(int);
+    release_phase_memory(buffer, state);
+    if (!arena_prepare(&state->arena, capacity)) {
+        return 0;
+    }
+
+    Player* players = phase_alloc(buffer, state, MEM_PLAYER_TABLE, (size_t)player_rows * sizeof(Player), false);
+    state->player_index = phase_alloc(buffer, state, MEM_PLAYER_INDEX, index_size * sizeof(int), false);
+    if (players == NULL || state->player_index == NULL) {
+        return 0;
+    }
+    state->player_capacity = player_rows;
+    state->player_index_mask = index_size - 1;
+    state->player_count = 0;
+    memset(&state->player_with_max_points, 0, sizeof(Player));
+    state->players = players; // the sport takes rows from now on
+    return 1;
+}
+
+/*
+    Drops the state of a finished sport in O(1): nothing is cleared player by player,
+    the arena just gives its pages back
+*/
+void reset_sport_state(SharedBuffer* buffer, SportState* state) {
+    release_phase_memory(buffer, state);
+    arena_reset(&state->arena);
+    state->players = NULL;
+    state->player_index = NULL;
+    state->player_index_mask = 0;
+    state->player_capacity = 0;
+    state->player_count = 0;
+}
+
+/*
+    Parses one atp_players.csv row (player_id,name_first,name_last,...) into the next
+    player slot and indexes it by id
+*/
+void add_player_from_csv_line(SharedBuffer* buffer, SportState* state, char* line) {
+    if (state->player_count >= state->player_capacity) {
+        return;
+    }
+
+    Player* player = &state->players[state->player_count];
+    char *p = strtok(line, ",");
+    int i = 0;
+    while (p != NULL && i < 3)
+    {
+        switch(i)
+        {
+            case 0:
+                player->player_id = atoi(p);
+                break;
+            case 1:
+                player->name_first = phase_strdup(buffer, state, p);
+                break;
+            case 2:
+                player->name_last = phase_strdup(buffer, state, p);
+                break;
+        }
+        p = strtok(NULL, ",");
+        i++;
+    }
+    if (player->name_first == NULL) player->name_first = "";
+    if (player->name_last == NULL) player->name_last = "";
+
+    unsigned int slot = hash_int(player->player_id) & state->player_index_mask;
+    while (state->player_index[slot] != 0) {
+        slot = (slot + 1) & state->player_index_mask;
+    }
+    state->player_index[slot] = state->player_count + 1;
+    state->player_count++;
+}
+
+/*
+    Looks up a player_id in an index built by add_player_from_csv_line
+*/
+int lookup_player_id(const int* player_index, unsigned int mask, const Player* players, int id) {
+    if (player_index == NULL) {
+        return -1;
+    }
+
+    unsigned int slot = hash_int(id) & mask;
+    while (player_index[slot] != 0) {
+        int index = player_index[slot] - 1;
+        if (players[index].player_id == id) {
+            return index;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return -1;
+}
+
+int find_player_by_id(const SportState* state, int id) {
+    return lookup_player_id(state->player_index, state->player_index_mask, state->players, id);
+}
+
+/*
+    Returns the player with the highest average points per tournament (first one on ties),
+    NULL if nobody has ranking points yet
+*/
+Player* find_player_with_max_points(const SportState* state) {
+    Player* best = NULL;
+    double best_avg = 0.0;
+    for (int i = 0; i < state->player_count; i++) {
+        Player* player = &state->players[i];
+        if (player->tourneyz_count == 0) {
+            continue;
+        }
+        double avg_points = (double)player->points / player->tourneyz_count;
+        if (best == NULL || avg_points > best_avg) {
+            best = player;
+            best_avg = avg_points;
+        }
+    }
+    return best;
+}
+
+/*
+    Adds a ranking date to the player's tourney set, returns true if it was not there yet.
+    The set is kept at most half full and doubled inside the arena when needed
+*/
+bool player_add_tourney(SharedBuffer* buffer, SportState* state, Player* player, int tourney) {
+    if (tourney == 0) {
+        tourney = -1; // 0 marks an empty slot
+    }
+
+    if ((player->tourneyz_count + 1) * 2 > player->tourneyz_capacity) {
+        int capacity = player->tourneyz_capacity ? player->tourneyz_capacity * 2 : INITIAL_TOURNEYZ;
+        int* set = phase_alloc(buffer, state, MEM_TOURNEY_SETS, capacity * sizeof(int), false);
+        if (set == NULL) {
+            return false;
+        }
+        for (int i = 0; i < player->tourneyz_capacity; i++) {
+            int key = player->tourneyz[i];
+            if (key != 0) {
+                unsigned int slot = hash_int(key) & (capacity - 1);
+                while (set[slot] != 0) {
+                    slot = (slot + 1) & (capacity - 1);
+                }
+                set[slot] = key;
+            }
+        }
+        player->tourneyz = set;
+        player->tourneyz_capacity = capacity;
+    }
+
+    unsigned int mask = player->tourneyz_capacity - 1;
+    unsigned int slot = hash_int(tourney) & mask;
+    while (player->tourneyz[slot] != 0) {
+        if (player->tourneyz[slot] == tourney) {
+            return false;
+        }
+        slot = (slot + 1) & mask;
+    }
+    player->tourneyz[slot] = tourney;
+    player->tourneyz_count++;
+    return true;
+}
+
+/*
+    Logs one counted ranking row for the date index. A new log chunk is an optional
+    allocation: with the degrade budget policy the log stops and the date index is skipped
+*/
+void record_ranking_row(SharedBuffer* buffer, SportState* state, int player, int date, int points, bool new_tourney) {
+    RankingLog* log = &state->ranking_log;
+    if (log->truncated) {
+        return;
+    }
+    if (ranking_log_needs_chunk(log)) {
+        RankingLogChunk* chunk = phase_alloc(buffer, state, MEM_DATE_INDEX, sizeof(RankingLogChunk), true);
+        if (chunk == NULL) {
+            printf("Memory budget: ranking log stopped, no date index for this phase\n");
+            log->truncated = true;
+            return;
+        }
+        ranking_log_add_chunk(log, chunk);
+    }
+    ranking_log_append(log, player, date, points, new_tourney);
+}
+
+/*
+    Rebuilds the date index of a sport from its ranking log, unless the log was cut short
+    or the index does not fit in the memory budget (degrade policy)
+*/
+void rebuild_date_index(SharedBuffer* buffer, SportState* state) {
+    drop_date_index(buffer, state);
+    if (state->ranking_log.truncated) {
+        return;
+    }
+
+    size_t index_bytes, build_bytes;
+    date_index_sizes(&state->ranking_log, state->player_count, &index_bytes, &build_bytes);
+    if (!memory_reserve(&buffer->profiler, MEM_DATE_INDEX, index_bytes + build_bytes, true)) {
+        printf("Memory budget: date index skipped for this phase\n");
+        return;
+    }
+    build_date_index(&state->date_index, &state->ranking_log, state->player_count);
+    memory_release(&buffer->profiler, MEM_DATE_INDEX, build_bytes + (state->date_index.built ? 0 : index_bytes));
+}
@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "../include/watch.h"
+#include "../include/async_writer.h"
+#include "../include/producer.h"
+#include "../include/utils.h"
+
+#define MAX_PATH 1024
+
+typedef struct {
+    int wd;
+    char path[MAX_PATH];
+} WatchedDir;
+
+typedef struct {
+    char path[MAX_PATH];
+    struct timespec ready_at; // when the file was last written, start of the freshness latency
+} PendingFile;
+
+typedef struct {
+    int fd;
+    WatchedDir dirs[WATCH_MAX_DIRS];
+    int dir_count;
+
+    char** ingested; // every file already streamed through the pipeline
+    int ingested_count;
+    int ingested_capacity;
+
+    PendingFile batch[WATCH_MAX_BATCH];
+    int batch_count;
+    int batch_number;
+
+    SharedBuffer* buffer; // the pipeline a full batch is streamed through
+    ProcessingPhase phase;
+} WatchState;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop_signal(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+static double timespec_diff(struct timespec end, struct timespec start) {
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+}
+
+// Same filter as search_csv_files: data files only, the player list is loaded once per phase
+static bool is_data_csv(const char* name) {
+    size_t len = strlen(name);
+    return name[0] != '.' && len > 4 && strcmp(name + len - 4, ".csv") == 0 &&
+           strstr(name, "atp_players") == NULL;
+}
+
+static bool already_ingested(WatchState* state, const char* path) {
+    for (int i = 0; i < state->ingested_count; i++) {
+        if (strcmp(state->ingested[i], path) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void mark_ingested(WatchState* state, const char* path) {
+    if (state->ingested_count == state->ingested_capacity) {
+        state->ingested_capacity = state->ingested_capacity ? state->ingested_capacity * 2 : 64;
+        state->ingested = realloc(state->ingested, state->ingested_capacity * sizeof(char*));
+    }
+    state->ingested[state->ingested_count++] = strdup(path);
+}
+
+static void queue_file(WatchState* state, const char* path) {
+    if (already_ingested(state, path)) {
+        printf("Watch: %s was already ingested, ignoring the rewrite\n", path);
+        return;
+    }
+    for (int i = 0; i < state->batch_count; i++) {
+        if (strcmp(state->batch[i].path, path) == 0) {
+            return;
+        }
+    }
+
+    PendingFile* pending = &state->batch[state->batch_count++];
+    strncpy(pending->path, path, MAX_PATH - 1);
+    pending->path[MAX_PATH - 1] = '\0';
+
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        pending->ready_at = st.st_mtim;
+    } else {
+        clock_gettime(CLOCK_REALTIME, &pending->ready_at);
+    }
+}
+
+// Every batch is a phase boundary for the async writer, the new report is published when the sync returns
+static void report_phase(SharedBuffer* buffer, ProcessingPhase phase) {
+    generate_phase_report(buffer, print_top_ppa_players, phase);
+    async_writer_sync_wait();
+}
+
+/*
+    Streams one batch of new files through the producer/consumer pipeline. The aggregates of
+    the phase are updated in place, then the report is rewritten atomically and the freshness
+    latency (file written -> report published) is printed
+*/
+static void ingest_batch(WatchState* state) {
+    SharedBuffer* buffer = state->buffer;
+    ProcessingPhase phase = state->phase;
+    int batch_number = ++state->batch_number;
+    start_hotspot(&buffer->profiler, "watch_batch");
+    start_phase_batch(buffer, phase);
+    for (int i = 0; i < state->batch_count; i++) {
+        process_csv_file(state->batch[i].path, buffer);
+        mark_ingested(state, state->batch[i].path);
+    }
+    finish_phase_batch(buffer);
+    report_phase(buffer, phase);
+    end_hotspot(&buffer->profiler, "watch_batch");
+
+    struct timespec published;
+    clock_gettime(CLOCK_REALTIME, &published);
+
+    double total = 0.0, max = 0.0;
+    for (int i = 0; i < state->batch_count; i++) {
+        double latency = timespec_diff(published, state->batch[i].ready_at);
+        total += latency;
+        if (latency > max) {
+            max = latency;
+        }
+    }
+    printf("Watch batch %d: %d file(s), freshness latency avg %.3f s, max %.3f s\n",
+           batch_number, state->batch_count, total / state->batch_count, max);
+    fflush(stdout);
+
+    state->batch_count = 0;
+}
+
+// Queues a new file, a full batch goes through the pipeline first so no file is ever dropped
+static void add_to_batch(WatchState* state, const char* path) {
+    if (state->batch_count == WATCH_MAX_BATCH) {
+        ingest_batch(state);
+    }
+    queue_file(state, path);
+}
+
+/*
+    Adds an inotify watch on dir_path and its subdirectories. Files that are already there are
+    either queued (directories created while watching) or just remembered as part of the
+    initial load, which the caller streams through the pipeline itself
+*/
+static void watch_directory(WatchState* state, const char* dir_path, bool queue_existing) {
+    if (state->dir_count == WATCH_MAX_DIRS) {
+        printf("Watch: too many directories, not watching %s\n", dir_path);
+        return;
+    }
+
+    int wd = inotify_add_watch(state->fd, dir_path, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR);
+    if (wd < 0) {
+        perror("inotify_add_watch() error");
+        return;
+    }
+    state->dirs[state->dir_count].wd = wd;
+    strncpy(state->dirs[state->dir_count].path, dir_path, MAX_PATH - 1);
+    state->dirs[state->dir_count].path[MAX_PATH - 1] = '\0';
+    state->dir_count++;
+
+    DIR* dir = opendir(dir_path);
+    if (dir == NULL) {
+        return;
+    }
+
+    struct dirent* entry;
+    char path[MAX_PATH];
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+
+        if (entry->d_type == DT_DIR) {
+            watch_directory(state, path, queue_existing);
+        } else if (is_data_csv(entry->d_name)) {
+            if (queue_existing) {
+                add_to_batch(state, path);
+            } else {
+                mark_ingested(state, path);
+            }
+        }
+    }
+    closedir(dir);
+}
+
+static const char* watched_dir_path(WatchState* state, int wd) {
+    for (int i = 0; i < state->dir_count; i++) {
+        if (state->dirs[i].wd == wd) {
+            return state->dirs[i].path;
+        }
+    }
+    return NULL;
+}
+
+/*
+    Reads the pending inotify events and turns them into queued files.
+    Only closed-after-write and moved-in files are taken, so half written CSVs are never parsed
+*/
+static void read_watch_events(WatchState* state) {
+    char events[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len = read(state->fd, events, sizeof(events));
+    if (len <= 0) {
+        return;
+    }
+
+    for (char* p = events; p < events + len; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len) {
+        struct inotify_event* event = (struct inotify_event*)p;
+        const char* dir_path = watched_dir_path(state, event->wd);
+        if (dir_path == NULL || event->len == 0) {
+            continue;
+        }
+
+        char path[MAX_PATH];
+        snprintf(path, sizeof(path), "%s/%s", dir_path, event->name);
+
+        if (event->mask & IN_ISDIR) {
+            if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                watch_directory(state, path, true);
+            }
+        } else if ((event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) && is_data_csv(event->name)) {
+            add_to_batch(state, path);
+        }
+    }
+}
+
+/*
+    Long running mode for one sport: the usual phase is run once over data/<sport>, then the
+    directory is watched with inotify and every batch of newly closed CSV files goes through
+    the same pipeline. Stops on SIGINT/SIGTERM
+*/
+void run_watch_mode(SharedBuffer* buffer, ProcessingPhase phase) {
+    const char* dir_path = sport_descriptors[phase].data_dir;
+
+    WatchState* state = calloc(1, sizeof(WatchState));
+    state->buffer = buffer;
+    state->phase = phase;
+    state->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (state->fd < 0) {
+        perror("inotify_init1() error");
+        start_phase_batch(buffer, PHASE_DONE);
+        buffer->all_data_processed = true;
+        free(state);
+        return;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    // Watch first, then load, so nothing closed during the initial load is missed
+    watch_directory(state, dir_path, false);
+
+    printf("Watch mode: initial load of %s...\n", dir_path);
+    start_hotspot(&buffer->profiler, "watch_initial_load");
+    read_players_in_shared_buffer(buffer, phase);
+    for (int i = 0; i < state->ingested_count; i++) {
+        process_csv_file(state->ingested[i], buffer);
+    }
+    finish_phase_batch(buffer);
+    report_phase(buffer, phase);
+    end_hotspot(&buffer->profiler, "watch_initial_load");
+
+    printf("Watch mode: watching %s for new CSV files (Ctrl+C to stop)\n", dir_path);
+    fflush(stdout);
+
+    while (!stop_requested) {
+        struct pollfd pfd = { .fd = state->fd, .events = POLLIN, .revents = 0 };
+        int ready = poll(&pfd, 1, state->batch_count > 0 ? WATCH_QUIET_MS : 1000);
+
+        if (ready > 0) {
+            read_watch_events(state);
+        }
+        if (state->batch_count > 0 && (ready == 0 || state->batch_count == WATCH_MAX_BATCH)) {
+            ingest_batch(state);
+        }
+    }
+
+    printf("Watch mode: stopping after %d batch(es)\n", state->batch_number);
+
+    start_phase_batch(buffer, PHASE_DONE);
+    buffer->all_data_processed = true;
+
+    close(state->fd);
+    for (int i = 0; i < state->ingested_count; i++) {
+        free(state->ingested[i]);
+    }
+    free(state->ingested);
+    free(state);
+}
@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "../include/zip_reader.h"
+
+#define ZIP_EOCD_SIGNATURE 0x06054b50
+#define ZIP_CENTRAL_SIGNATURE 0x02014b50
+#define ZIP_LOCAL_SIGNATURE 0x04034b50
+#define ZIP_EOCD_SIZE 22
+#define ZIP_CENTRAL_SIZE 46
+#define ZIP_LOCAL_SIZE 30
+#define ZIP_MAX_COMMENT 65535
+
+// Zip integers are little endian and unaligned
+static uint16_t read_u16(const unsigned char* p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t read_u32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static int read_exact(int fd, void* data, size_t size, off_t offset) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, (char*)data + done, size - done, offset + done);
+        if (n <= 0) {
+            return 0;
+        }
+        done += n;
+    }
+    return 1;
+}
+
+/*
+    Opens an archive and reads its central directory: the end of central directory record is
+    searched backwards from the end of the file (it is followed by a comment of up to 64 KB).
+    Zip64 archives and encrypted members are not supported
+*/
+int zip_open(ZipArchive* archive, const char* path) {
+    memset(archive, 0, sizeof(ZipArchive));
+    archive->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (archive->fd < 0) {
+        printf("Error opening archive: %s\n", path);
+        return 0;
+    }
+
+    struct stat st;
+    fstat(archive->fd, &st);
+    size_t tail_size = st.st_size < ZIP_EOCD_SIZE + ZIP_MAX_COMMENT ? (size_t)st.st_size : ZIP_EOCD_SIZE + ZIP_MAX_COMMENT;
+    unsigned char* tail = malloc(tail_size + 1);
+    if (tail == NULL || tail_size < ZIP_EOCD_SIZE || !read_exact(archive->fd, tail, tail_size, st.st_size - tail_size)) {
+        printf("Not a zip archive: %s\n", path);
+        free(tail);
+        zip_close(archive);
+        return 0;
+    }
+
+    const unsigned char* eocd = NULL;
+    for (long i = (long)tail_size - ZIP_EOCD_SIZE; i >= 0; i--) {
+        if (read_u32(tail + i) == ZIP_EOCD_SIGNATURE) {
+            eocd = tail + i;
+            break;
+        }
+    }
+    if (eocd == NULL) {
+        printf("Not a zip archive: %s\n", path);
+        free(tail);
+        zip_close(archive);
+        return 0;
+    }
+
+    int entries = read_u16(eocd + 10);
+    uint32_t directory_size = read_u32(eocd + 12);
+    uint32_t directory_offset = read_u32(eocd + 16);
+    free(tail);
+    if (directory_offset == 0xFFFFFFFFu || entries == 0xFFFF) {
+        printf("Zip64 archives are not supported: %s\n", path);
+        zip_close(archive);
+        return 0;
+    }
+
+    unsigned char* directory = malloc(directory_size + 1);
+    archive->members = calloc(entries + 1, sizeof(ZipMember));
+    if (directory == NULL || archive->members == NULL ||
+        !read_exact(archive->fd, directory, directory_size, directory_offset)) {
+        printf("Error reading the central directory of %s\n", path);
+        free(directory);
+        zip_close(archive);
+        return 0;
+    }
+
+    const unsigned char* p = directory;
+    const unsigned char* end = directory + directory_size;
+    for (int i = 0; i < entries && p + ZIP_CENTRAL_SIZE <= end; i++) {
+        if (read_u32(p) != ZIP_CENTRAL_SIGNATURE) {
+            break;
+        }
+        uint16_t flags = read_u16(p + 8);
+        uint16_t name_length = read_u16(p + 28);
+        uint16_t extra_length = read_u16(p + 30);
+        uint16_t comment_length = read_u16(p + 32);
+        if (p + ZIP_CENTRAL_SIZE + name_length > end) {
+            break;
+        }
+
+        ZipMember* member = &archive->members[archive->member_count];
+        member->method = read_u16(p + 10);
+        member->compressed_size = read_u32(p + 20);
+        member->uncompressed_size = read_u32(p + 24);
+        member->local_offset = read_u32(p + 42);
+        size_t copy = name_length < ZIP_MAX_NAME - 1 ? name_length : ZIP_MAX_NAME - 1;
+        memcpy(member->name, p + ZIP_CENTRAL_SIZE, copy);
+        member->name[copy] = '\0';
+
+        bool encrypted = flags & 1;
+        bool supported_method = member->method == 0 || member->method == 8;
+        bool directory_entry = copy > 0 && member->name[copy - 1] == '/';
+        if (!encrypted && supported_method && !directory_entry) {
+            archive->member_count++;
+        } else if (!directory_entry) {
+            printf("Skipping unsupported zip member %s in %s\n", member->name, path);
+        }
+        p += ZIP_CENTRAL_SIZE + name_length + extra_length + comment_length;
+    }
+
+    free(directory);
+    return 1;
+}
+
+void zip_close(ZipArchive* archive) {
+    if (archive->fd >= 0) {
+        close(archive->fd);
+    }
+    free(archive->members);
+    archive->fd = -1;
+    archive->members = NULL;
+    archive->member_count = 0;
+}
+
+// Index of the member whose file name (without directories) is base_name, -1 if there is none
+int zip_find_member(const ZipArchive* archive, const char* base_name) {
+    for (int i = 0; i < archive->member_count; i++) {
+        const char* slash = strrchr(archive->members[i].name, '/');
+        const char* name = slash ? slash + 1 : archive->members[i].name;
+        if (strcmp(name, base_name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// The sizes in the local header may differ from the central directory, only the lengths are used
+static off_t member_data_offset(const ZipArchive* archive, const ZipMember* member) {
+    unsigned char header[ZIP_LOCAL_SIZE];
+    if (!read_exact(archive->fd, header, ZIP_LOCAL_SIZE, member->local_offset) ||
+        read_u32(header) != ZIP_LOCAL_SIGNATURE) {
+        return -1;
+    }
+    return (off_t)member->local_offset + ZIP_LOCAL_SIZE + read_u16(header + 26) + read_u16(header + 28);
+}
+
+typedef bool (*ZipChunkCallback)(const char* data, size_t size, void* context);
+
+/*
+    Streams the uncompressed bytes of a member chunk by chunk: raw deflate (no zlib header)
+    for method 8, a plain copy for stored members. Only ZIP_INPUT_CHUNK + ZIP_OUTPUT_CHUNK
+    bytes are in memory whatever the member size
+*/
+static int stream_member(const ZipArchive* archive, const ZipMember* member, ZipChunkCallback callback, void* context) {
+    off_t offset = member_data_offset(archive, member);
+    if (offset < 0) {
+        printf("Bad local header for zip member %s\n", member->name);
+        return 0;
+    }
+
+    unsigned char* input = malloc(ZIP_INPUT_CHUNK);
+    unsigned char* output = malloc(ZIP_OUTPUT_CHUNK);
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (input == NULL || output == NULL || (member->method == 8 && inflateInit2(&stream, -MAX_WBITS) != Z_OK)) {
+        free(input);
+        free(output);
+        return 0;
+    }
+
+    int ok = 1;
+    bool done = false;
+    uint32_t remaining = member->compressed_size;
+    while (!done && remaining > 0) {
+        size_t want = remaining < ZIP_INPUT_CHUNK ? remaining : ZIP_INPUT_CHUNK;
+        if (!read_exact(archive->fd, input, want, offset)) {
+            ok = 0;
+            break;
+        }
+        offset += want;
+        remaining -= want;
+
+        if (member->method == 0) {
+            done = !callback((const char*)input, want, context);
+            continue;
+        }
+
+        stream.next_in = input;
+        stream.avail_in = want;
+        while (!done && stream.avail_in > 0) {
+            stream.next_out = output;
+            stream.avail_out = ZIP_OUTPUT_CHUNK;
+            int status = inflate(&stream, Z_NO_FLUSH);
+            if (status != Z_OK && status != Z_STREAM_END) {
+                printf("Corrupt deflate data in zip member %s\n", member->name);
+                ok = 0;
+                done = true;
+                break;
+            }
+            size_t produced = ZIP_OUTPUT_CHUNK - stream.avail_out;
+            if (produced > 0 && !callback((const char*)output, produced, context)) {
+                done = true;
+            }
+            if (status == Z_STREAM_END) {
+                done = true;
+            }
+        }
+    }
+
+    if (member->method == 8) {
+        inflateEnd(&stream);
+    }
+    free(input);
+    free(output);
+    return ok;
+}
+
+typedef struct {
+    char line[ZIP_MAX_LINE];
+    size_t length;
+    bool stopped;
+    long lines;
+    ZipLineCallback callback;
+    void* context;
+} LineSplitter;
+
+static bool emit_line(LineSplitter* splitter) {
+    if (splitter->length > 0 && splitter->line[splitter->length - 1] == '\r') {
+        splitter->length--;
+    }
+    splitter->line[splitter->length] = '\0';
+    splitter->length = 0;
+    splitter->lines++;
+    if (!splitter->callback(splitter->line, splitter->context)) {
+        splitter->stopped = true;
+    }
+    return !splitter->stopped;
+}
+
+// Lines can span chunks, the unfinished one is carried over in the splitter
+static bool split_lines(const char* data, size_t size, void* context) {
+    LineSplitter* splitter = context;
+    const char* end = data + size;
+    while (data < end) {
+        const char* newline = memchr(data, '\n', end - data);
+        const char* stop = newline ? newline : end;
+        size_t room = ZIP_MAX_LINE - 1 - splitter->length;
+        size_t take = (size_t)(stop - data) < room ? (size_t)(stop - data) : room; // the rest of a long line is cut
+        memcpy(splitter->line + splitter->length, data, take);
+        splitter->length += take;
+        if (newline == NULL) {
+            break;
+        }
+        if (!emit_line(splitter)) {
+            return false;
+        }
+        data = newline + 1;
+    }
+    return true;
+}
+
+/*
+    Calls `callback` for every line of a member, returns the number of lines or -1 on error
+*/
+long zip_read_member(const ZipArchive* archive, const ZipMember* member, ZipLineCallback callback, void* context) {
+    LineSplitter* splitter = calloc(1, sizeof(LineSplitter));
+    if (splitter == NULL) {
+        return -1;
+    }
+    splitter->callback = callback;
+    splitter->context = context;
+
+    int ok = stream_member(archive, member, split_lines, splitter);
+    if (ok && !splitter->stopped && splitter->length > 0) {
+        emit_line(splitter); // last line without a trailing newline
+    }
+
+    long lines = ok ? splitter->lines : -1;
+    free(splitter);
+    return lines;
+}
+
+typedef struct {
+    char* data;
+    size_t size;
+    size_t capacity;
+    bool failed;
+} MemberBuffer;
+
+static bool append_chunk(const char* data, size_t size, void* context) {
+    MemberBuffer* buffer = context;
+    if (buffer->size + size + 1 > buffer->capacity) {
+        size_t capacity = (buffer->size + size + 1) * 2;
+        char* grown = realloc(buffer->data, capacity);
+        if (grown == NULL) {
+            buffer->failed = true;
+            return false;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+    return true;
+}
+
+/*
+    Decompresses a whole member into a malloc'ed, NUL terminated buffer (for small members
+    that are read as a file, like atp_players.csv). NULL on error
+*/
+char* zip_extract_member(const ZipArchive* archive, const ZipMember* member, size_t* size) {
+    MemberBuffer buffer = { malloc((size_t)member->uncompressed_size + 1), 0, (size_t)member->uncompressed_size + 1, false };
+    if (buffer.data == NULL || !stream_member(archive, member, append_chunk, &buffer) || buffer.failed) {
+        free(buffer.data);
+        return NULL;
+    }
+    buffer.data[buffer.size] = '\0';
+    *size = buffer.size;
+    return buffer.data;
+}